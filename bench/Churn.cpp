@@ -0,0 +1,409 @@
+#include "system.h"
+
+#include "Log.h"
+#include "Entry.h"
+#include "Receiver.h"
+#include "Scheduler.h"
+#include "Clock.h"
+
+/*
+ * Churn check.  This runs simulated hours of keepalives from a large set
+ * of keys through the scheduler on a virtual clock, and checks every
+ * expiry against a model of what should have happened: each key that
+ * stops being refreshed must expire exactly once, at its deadline, and
+ * expiries must come out in deadline order.
+ *
+ * Usage: timeoutd-churn [-k keys] [-H hours] [-t max timeout] [-s seed]
+ *     [-E]
+ *
+ * Each key has a timeout between 5 seconds and the maximum, and mostly
+ * refreshes well inside it.  Now and then a key changes its timeout,
+ * goes quiet for a while, which may or may not be long enough to expire,
+ * or is removed with a zero timeout and comes back later.  -E turns off
+ * lazy rescheduling, to check the eager path.
+ *
+ * The clock is moved to each keepalive's time in turn.  Whenever a
+ * deadline in the model comes up, before any keepalive at or after it is
+ * delivered, the clock is moved there and the scheduler is asked for
+ * whatever is due, so an expiry is on time if it comes out at that step.
+ * Exits non-zero if anything didn't match.
+ */
+
+#define MIN_TIMEOUT 5
+
+// Chances, per keepalive due, of the key being removed or going quiet
+// instead, and of it picking a new timeout
+#define REMOVE_PER_MILLION 1000
+#define QUIET_PER_MILLION 2000
+#define CHANGE_PER_MILLION 10000
+
+// Errors printed before just counting them
+#define MAX_REPORTED 10
+
+#define MICROS 1000000LL
+
+// Where the virtual clock starts, well away from zero
+#define START_MICROS (1000000LL * MICROS)
+
+struct ChurnKey {
+	int timeout;
+
+	// What the scheduler should be holding for the key
+	bool present;
+	int64_t deadline;
+
+	// Earliest time the key is queued in deadlines, or zero.  Like the
+	// scheduler's lazy rescheduling, a refresh that only pushes the
+	// deadline back leaves it queued where it is, and it's queued again
+	// for the real deadline when that time comes up.
+	int64_t queued;
+};
+
+// A time something happens to a key
+struct ChurnEvent {
+	int64_t at;
+	int index;
+
+	bool operator>(ChurnEvent const &other) const {
+		return at > other.at;
+	}
+};
+
+typedef std::priority_queue<ChurnEvent, std::vector<ChurnEvent>,
+	std::greater<ChurnEvent>> ChurnQueue;
+
+class Churn {
+public:
+	Churn(int keyCount, int maxTimeout, unsigned long seed, bool lazy);
+
+	void run(int64_t duration);
+	int report(double hours, double elapsed);
+
+private:
+	std::vector<std::string> names;
+	std::vector<ChurnKey> keys;
+
+	VirtualClockRef clock;
+	SchedulerRef scheduler;
+
+	std::mt19937_64 random;
+	int maxTimeout;
+
+	// Next keepalive for each key, and each deadline the model expects
+	ChurnQueue senders;
+	ChurnQueue deadlines;
+
+	int64_t lastCheck;
+	int64_t lastExpired;
+	EntryBatch expired;
+
+	unsigned long keepalives;
+	unsigned long removals;
+	unsigned long expiries;
+	unsigned long errors;
+
+	int64_t randomMicros(int64_t low, int64_t high);
+	void queue(int index, int64_t at);
+	void act(int64_t now, int index);
+	void check(int64_t now);
+	void error(char const *what, int index, int64_t now);
+};
+
+Churn::Churn(int keyCount, int maxTimeout, unsigned long seed, bool lazy) :
+	random(seed)
+{
+	this->maxTimeout= maxTimeout;
+
+	clock= VirtualClock::Create(START_MICROS);
+
+	scheduler= Scheduler::Create(keyCount);
+	scheduler->setClock(clock);
+	scheduler->setLazyRescheduling(lazy);
+
+	names.reserve(keyCount);
+	keys.resize(keyCount);
+
+	char buffer[32];
+	for (int i= 0; i < keyCount; i++) {
+		snprintf(buffer, sizeof(buffer), "churn.%d", i);
+		names.push_back(buffer);
+
+		ChurnKey& key= keys[i];
+		key.timeout= MIN_TIMEOUT + (random() % (maxTimeout - MIN_TIMEOUT + 1));
+		key.present= false;
+		key.deadline= 0;
+		key.queued= 0;
+
+		// Spread the first keepalives over the first timeout period
+		ChurnEvent event;
+		event.at= START_MICROS + randomMicros(0, key.timeout * MICROS);
+		event.index= i;
+		senders.push(event);
+	}
+
+	lastCheck= START_MICROS;
+	lastExpired= 0;
+
+	keepalives= 0;
+	removals= 0;
+	expiries= 0;
+	errors= 0;
+}
+
+int64_t Churn::randomMicros(int64_t low, int64_t high)
+{
+	return low + (int64_t)(random() % (uint64_t)(high - low + 1));
+}
+
+void Churn::queue(int index, int64_t at)
+{
+	ChurnEvent event;
+	event.at= at;
+	event.index= index;
+	deadlines.push(event);
+
+	keys[index].queued= at;
+}
+
+void Churn::error(char const *what, int index, int64_t now)
+{
+	if (errors++ < MAX_REPORTED) {
+		ChurnKey const &key= keys[index];
+		fprintf(stderr, "%s: %s at %+.6f s, deadline %+.6f s\n",
+			what, names[index].c_str(),
+			(now - START_MICROS) / 1e6,
+			key.present ? (key.deadline - START_MICROS) / 1e6 : 0.0);
+	}
+}
+
+// Take whatever the scheduler says is due now, and compare it with what
+// the model says should be.
+void Churn::check(int64_t now)
+{
+	expired.clear();
+	scheduler->expireDue(expired);
+
+	for (EntryRef entry : expired) {
+		int index= atoi(entry->getKey() + strlen("churn."));
+		ChurnKey& key= keys[index];
+
+		if (!key.present) {
+			error("Expired when it shouldn't exist", index, now);
+			continue;
+		}
+
+		if (key.deadline > now) {
+			error("Expired early", index, now);
+		} else if (key.deadline <= lastCheck) {
+			error("Expired late", index, now);
+		}
+
+		if (key.deadline < lastExpired) {
+			error("Expired out of deadline order", index, now);
+		}
+		lastExpired= key.deadline;
+
+		key.present= false;
+		expiries++;
+	}
+
+	// Anything the model still has as present with a deadline that's
+	// passed should have just expired.  Keys refreshed since they were
+	// queued go back in for their current deadline.
+	while (!deadlines.empty() && (deadlines.top().at <= now)) {
+		ChurnEvent due= deadlines.top();
+		deadlines.pop();
+
+		ChurnKey& key= keys[due.index];
+		if (key.queued != due.at) {
+			// Superseded by an earlier deadline
+			continue;
+		}
+		key.queued= 0;
+
+		if (!key.present) {
+			continue;
+		}
+
+		if (key.deadline <= now) {
+			error("Didn't expire", due.index, now);
+
+			// Only report it once
+			key.present= false;
+		} else {
+			queue(due.index, key.deadline);
+		}
+	}
+
+	lastCheck= now;
+}
+
+// The key's sender does whatever it does next
+void Churn::act(int64_t now, int index)
+{
+	ChurnKey& key= keys[index];
+	char const *name= names[index].c_str();
+
+	ChurnEvent next;
+	next.index= index;
+
+	int roll= random() % 1000000;
+
+	if (roll < REMOVE_PER_MILLION) {
+		scheduler->receive(name, NULL, 0, "127.0.0.1");
+		removals++;
+
+		key.present= false;
+
+		next.at= now + randomMicros(MICROS, 2 * maxTimeout * MICROS);
+	} else if (roll < REMOVE_PER_MILLION + QUIET_PER_MILLION) {
+		// Back somewhere between well inside the timeout and long after
+		next.at= now + randomMicros(key.timeout * MICROS / 2,
+			3 * key.timeout * MICROS);
+	} else {
+		if (roll < REMOVE_PER_MILLION + QUIET_PER_MILLION +
+			CHANGE_PER_MILLION)
+		{
+			key.timeout= MIN_TIMEOUT +
+				(random() % (maxTimeout - MIN_TIMEOUT + 1));
+		}
+
+		scheduler->receive(name, NULL, key.timeout, "127.0.0.1");
+		keepalives++;
+
+		key.present= true;
+		key.deadline= now + key.timeout * MICROS;
+
+		if ((key.queued == 0) || (key.deadline < key.queued)) {
+			queue(index, key.deadline);
+		}
+
+		next.at= now + randomMicros(key.timeout * MICROS / 5,
+			key.timeout * MICROS * 9 / 10);
+	}
+
+	senders.push(next);
+}
+
+void Churn::run(int64_t duration)
+{
+	int64_t end= START_MICROS + duration;
+
+	while (!senders.empty() && (senders.top().at <= end)) {
+		// Deadlines go first, so anything due has expired before a
+		// keepalive at the same time arrives
+		if (!deadlines.empty() &&
+			(deadlines.top().at <= senders.top().at))
+		{
+			int64_t at= deadlines.top().at;
+
+			clock->set(at);
+			check(at);
+			continue;
+		}
+
+		ChurnEvent event= senders.top();
+		senders.pop();
+
+		clock->set(event.at);
+		act(event.at, event.index);
+	}
+
+	// Let everything left run out, which checks the rest of the deadlines
+	int64_t last= end + maxTimeout * MICROS;
+
+	while (!deadlines.empty() && (deadlines.top().at <= last)) {
+		int64_t at= deadlines.top().at;
+
+		clock->set(at);
+		check(at);
+	}
+
+	if (scheduler->getEntryCount() != 0) {
+		fprintf(stderr, "%d entries left after the last deadline\n",
+			scheduler->getEntryCount());
+		errors++;
+	}
+}
+
+int Churn::report(double hours, double elapsed)
+{
+	printf("Simulated %.2f hours with %d keys in %.1f s\n",
+		hours, (int)keys.size(), elapsed);
+	printf("%lu keepalives, %lu removals, %lu expiries, "
+		"%lu index operations\n",
+		keepalives, removals, expiries, scheduler->getIndexOperations());
+
+	if (errors > 0) {
+		printf("%lu errors\n", errors);
+		return 1;
+	}
+
+	printf("Every expiry fired once, on time and in deadline order\n");
+	return 0;
+}
+
+static double nowSeconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+int main(int argc, char* argv[])
+{
+	int keyCount= 10000;
+	double hours= 1;
+	int maxTimeout= 60;
+	unsigned long seed= 42;
+	bool lazy= true;
+
+	int c;
+	while ((c= getopt(argc, argv, "k:H:t:s:E")) != -1) {
+		switch (c) {
+		case 'k':
+			keyCount= atoi(optarg);
+			break;
+
+		case 'H':
+			hours= atof(optarg);
+			break;
+
+		case 't':
+			maxTimeout= atoi(optarg);
+			break;
+
+		case 's':
+			seed= strtoul(optarg, NULL, 10);
+			break;
+
+		case 'E':
+			lazy= false;
+			break;
+
+		default:
+			fprintf(stderr, "Unknown argument %c\n", optopt);
+			exit(1);
+		}
+	}
+
+	if ((keyCount < 1) || (hours <= 0)) {
+		fprintf(stderr, "Counts and times must be positive\n");
+		exit(1);
+	}
+	if (maxTimeout < MIN_TIMEOUT) {
+		fprintf(stderr, "The maximum timeout must be at least %d\n",
+			MIN_TIMEOUT);
+		exit(1);
+	}
+
+	// Removals are logged at INFO, and there are a lot of them
+	Log::setLogLevel(LOG_ERROR);
+
+	double start= nowSeconds();
+
+	Churn churn(keyCount, maxTimeout, seed, lazy);
+	churn.run((int64_t)(hours * 3600 * MICROS));
+
+	return churn.report(hours, nowSeconds() - start);
+}
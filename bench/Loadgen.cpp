@@ -0,0 +1,678 @@
+#include "system.h"
+
+#include "KeepalivePacket.h"
+
+/*
+ * End-to-end load generator.  This drives a running timeoutd over the
+ * loopback interface the way a fleet of senders would, and reports what
+ * rate it managed, what the kernel dropped on the way in, and for keys
+ * that were deliberately let go, how long timeoutd took to notice.
+ *
+ * Usage: timeoutd-bench [-a address] [-p port] [-P port] [-K psk]
+ *     [-k keys] [-i interval] [-r rate] [-t timeout] [-m signed]
+ *     [-d dying] [-T seconds] [-x prefix] [-S path]
+ *
+ * Keys are refreshed round robin, one record per packet, so each key is
+ * refreshed every keys / rate seconds.  The rate defaults to refreshing
+ * every key once per interval.  Signed keys go to the signed port and the
+ * rest to the simple port.
+ *
+ * Each dying key stops being refreshed at a random time in the second
+ * quarter of the run.  If timeoutd was started with -S, its event socket
+ * is used to see when each of them expired; without -S only the sending
+ * side is measured.  At the end every other key is removed with a zero
+ * timeout, so nothing is left behind to expire later.
+ */
+
+// How long to wait past the last deadline for expiries to arrive
+#define GRACE_SECONDS 3
+
+// Most packets sent between checks of the clock
+#define SEND_BATCH 256
+
+static int64_t nowNanos()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ((int64_t)ts.tv_sec * 1000000000LL) + ts.tv_nsec;
+}
+
+struct Options {
+	char const *address;
+	int simplePort;
+	int signedPort;
+	char const *preSharedKey;
+	int keyCount;
+	double interval;
+	double rate;
+	int timeout;
+	double signedFraction;
+	double dyingFraction;
+	int duration;
+	char const *prefix;
+	char const *eventPath;
+};
+
+struct Key {
+	bool isSigned;
+	bool dying;
+
+	// When a dying key stops being refreshed, from the start of the run
+	int64_t stopAt;
+
+	// Last time a refresh was sent, or zero if never
+	int64_t lastSent;
+
+	// Filled in by the event reader.  A key can expire more than once if
+	// refreshes fall behind, so this is the last time.
+	int64_t expiredAt;
+	int expireCount;
+
+	// Whether a dying key expired after it stopped being refreshed
+	bool detected;
+};
+
+class Generator {
+public:
+	Generator(Options const &options);
+
+	bool start();
+	void run();
+	void report();
+
+private:
+	Options options;
+
+	std::vector<Key> keys;
+
+	int sock;
+	struct sockaddr_storage simpleAddr;
+	struct sockaddr_storage signedAddr;
+	socklen_t addrLen;
+
+	KeepalivePacket simplePacket;
+	KeepalivePacket signedPacket;
+
+	unsigned long sent;
+	unsigned long sendErrors;
+	double elapsed;
+
+	unsigned long simpleDropsBefore;
+	unsigned long signedDropsBefore;
+	unsigned long simpleDrops;
+	unsigned long signedDrops;
+
+	// Whether anything was listening on each port
+	bool simpleBound;
+	bool signedBound;
+
+	// When the run started, for the event reader to tell which expiries
+	// come after a key stopped being refreshed
+	int64_t startedAt;
+
+	int eventFd;
+	std::thread *reader;
+	std::atomic<int> dyingExpired;
+	unsigned long eventsDropped;
+
+	bool send(int index, int timeout, time_t now);
+	void pace(int64_t start, uint64_t count, int64_t end,
+		std::function<void(uint64_t)> each);
+
+	bool subscribe();
+	void readEvents();
+
+	static bool readDrops(int port, unsigned long *drops);
+};
+
+Generator::Generator(Options const &options) :
+	options(options)
+{
+	sock= -1;
+	addrLen= 0;
+
+	sent= 0;
+	sendErrors= 0;
+	elapsed= 0;
+
+	simpleDropsBefore= 0;
+	signedDropsBefore= 0;
+	simpleDrops= 0;
+	signedDrops= 0;
+
+	simpleBound= false;
+	signedBound= false;
+
+	startedAt= 0;
+
+	eventFd= -1;
+	reader= NULL;
+	dyingExpired= 0;
+	eventsDropped= 0;
+}
+
+// Sum the drop counts of every UDP socket bound to the port.  There can be
+// one for each address family, and more with multicast.
+bool Generator::readDrops(int port, unsigned long *drops)
+{
+	char const *files[]= { "/proc/net/udp", "/proc/net/udp6" };
+	bool found= false;
+
+	*drops= 0;
+
+	for (char const *file : files) {
+		FILE *in= fopen(file, "rt");
+		if (in == NULL) {
+			continue;
+		}
+
+		char line[512];
+		while (fgets(line, sizeof(line), in) != NULL) {
+			// sl local_address rem_address st tx:rx tr:when retrnsmt uid
+			// timeout inode ref pointer drops
+			char local[64];
+			unsigned long lineDrops;
+			if (sscanf(line, "%*s %63s %*s %*s %*s %*s %*s %*s %*s "
+				"%*s %*s %*s %lu", local, &lineDrops) != 2)
+			{
+				continue;
+			}
+
+			char *colon= strrchr(local, ':');
+			if ((colon != NULL) && (strtol(colon + 1, NULL, 16) == port)) {
+				*drops+= lineDrops;
+				found= true;
+			}
+		}
+
+		fclose(in);
+	}
+
+	return found;
+}
+
+bool Generator::start()
+{
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_flags= AI_NUMERICHOST;
+	hints.ai_family= AF_UNSPEC;
+	hints.ai_socktype= SOCK_DGRAM;
+
+	struct addrinfo *hostInfo;
+	int lookupRval= getaddrinfo(options.address, NULL, &hints, &hostInfo);
+	if (lookupRval != 0) {
+		fprintf(stderr, "Invalid address %s: %s\n",
+			options.address, gai_strerror(lookupRval));
+		return false;
+	}
+
+	addrLen= hostInfo->ai_addrlen;
+	memcpy(&simpleAddr, hostInfo->ai_addr, addrLen);
+	memcpy(&signedAddr, hostInfo->ai_addr, addrLen);
+
+	if (hostInfo->ai_family == AF_INET) {
+		((struct sockaddr_in *)&simpleAddr)->sin_port=
+			htons(options.simplePort);
+		((struct sockaddr_in *)&signedAddr)->sin_port=
+			htons(options.signedPort);
+	} else {
+		((struct sockaddr_in6 *)&simpleAddr)->sin6_port=
+			htons(options.simplePort);
+		((struct sockaddr_in6 *)&signedAddr)->sin6_port=
+			htons(options.signedPort);
+	}
+
+	sock= socket(hostInfo->ai_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	freeaddrinfo(hostInfo);
+
+	if (sock == -1) {
+		fprintf(stderr, "Unable to create socket: %s\n", strerror(errno));
+		return false;
+	}
+
+	if (options.preSharedKey != NULL) {
+		signedPacket.setPreSharedKey(options.preSharedKey);
+	}
+
+	// The same seed picks the same keys every run
+	std::mt19937 random(42);
+	std::uniform_real_distribution<double> unit(0, 1);
+
+	int64_t durationNanos= (int64_t)options.duration * 1000000000LL;
+
+	keys.resize(options.keyCount);
+	for (int i= 0; i < options.keyCount; i++) {
+		Key& key= keys[i];
+
+		key.isSigned= (unit(random) < options.signedFraction);
+		key.dying= (unit(random) < options.dyingFraction);
+		key.stopAt= (durationNanos / 4) + (unit(random) * durationNanos / 4);
+		key.lastSent= 0;
+		key.expiredAt= 0;
+		key.expireCount= 0;
+		key.detected= false;
+	}
+
+	startedAt= nowNanos();
+
+	if ((options.eventPath != NULL) && !subscribe()) {
+		return false;
+	}
+
+	simpleBound= readDrops(options.simplePort, &simpleDropsBefore);
+	signedBound= readDrops(options.signedPort, &signedDropsBefore);
+
+	return true;
+}
+
+bool Generator::subscribe()
+{
+	eventFd= socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family= AF_UNIX;
+	strncpy(addr.sun_path, options.eventPath, sizeof(addr.sun_path) - 1);
+
+	std::string request= "SUBSCRIBE ";
+	request.append(options.prefix);
+	request.append("\n");
+
+	if ((eventFd == -1) ||
+		(connect(eventFd, (struct sockaddr *)&addr, sizeof(addr)) == -1) ||
+		(write(eventFd, request.data(), request.size()) !=
+			(ssize_t)request.size()))
+	{
+		fprintf(stderr, "Unable to subscribe on %s: %s\n",
+			options.eventPath, strerror(errno));
+		return false;
+	}
+
+	reader= new std::thread(&Generator::readEvents, this);
+	return true;
+}
+
+void Generator::readEvents()
+{
+	std::string input;
+	size_t prefixLen= strlen(options.prefix);
+
+	for (;;) {
+		char buffer[4096];
+		ssize_t readRval= read(eventFd, buffer, sizeof(buffer));
+		if ((readRval == -1) && (errno == EINTR)) {
+			continue;
+		}
+		if (readRval <= 0) {
+			break;
+		}
+
+		int64_t now= nowNanos();
+		input.append(buffer, readRval);
+
+		size_t newline;
+		while ((newline= input.find('\n')) != std::string::npos) {
+			std::string line= input.substr(0, newline);
+			input.erase(0, newline + 1);
+
+			char const *text= line.c_str();
+			if (strncmp(text, "DROPPED ", 8) == 0) {
+				eventsDropped+= strtoul(text + 8, NULL, 10);
+				continue;
+			}
+			if (strncmp(text, "EXPIRE ", 7) != 0) {
+				continue;
+			}
+
+			text+= 7;
+			if (strncmp(text, options.prefix, prefixLen) != 0) {
+				continue;
+			}
+
+			char *end;
+			long index= strtol(text + prefixLen, &end, 10);
+			if ((*end != ' ') || (index < 0) || (index >= (long)keys.size()))
+			{
+				continue;
+			}
+
+			Key& key= keys[index];
+			key.expiredAt= now;
+			key.expireCount++;
+
+			if (key.dying && !key.detected &&
+				(now - startedAt >= key.stopAt))
+			{
+				key.detected= true;
+				dyingExpired++;
+			}
+		}
+	}
+}
+
+bool Generator::send(int index, int timeout, time_t now)
+{
+	Key& key= keys[index];
+
+	char name[128];
+	snprintf(name, sizeof(name), "%s%d", options.prefix, index);
+
+	KeepalivePacket& packet= key.isSigned ? signedPacket : simplePacket;
+	packet.setRecord(name, timeout);
+	packet.refresh(now);
+
+	struct sockaddr const *addr= (struct sockaddr const *)
+		(key.isSigned ? &signedAddr : &simpleAddr);
+
+	if (packet.sendTo(sock, addr, addrLen, 0) == -1) {
+		sendErrors++;
+		return false;
+	}
+
+	return true;
+}
+
+// Call each with slot numbers from zero up to count, at the configured
+// rate from start.  Sleeps when ahead, and catches up in batches when
+// behind.  If end isn't zero, stops then even if behind.
+void Generator::pace(int64_t start, uint64_t count, int64_t end,
+	std::function<void(uint64_t)> each)
+{
+	uint64_t slot= 0;
+
+	while (slot < count) {
+		int64_t now= nowNanos();
+		if ((end != 0) && (now >= end)) {
+			break;
+		}
+
+		uint64_t due= (uint64_t)((now - start) * options.rate / 1e9);
+		if (due > count) {
+			due= count;
+		}
+
+		if (slot >= due) {
+			struct timespec pause= { 0, 100000 };
+			nanosleep(&pause, NULL);
+			continue;
+		}
+
+		for (int i= 0; (i < SEND_BATCH) && (slot < due); i++) {
+			each(slot++);
+		}
+	}
+}
+
+void Generator::run()
+{
+	int64_t start= startedAt;
+	int64_t end= start + (int64_t)options.duration * 1000000000LL;
+	uint64_t count= (uint64_t)(options.duration * options.rate);
+
+	pace(start, count, end, [this, start](uint64_t slot) {
+		int index= slot % keys.size();
+		Key& key= keys[index];
+		int64_t now= nowNanos();
+
+		if (key.dying && (now - start >= key.stopAt)) {
+			return;
+		}
+		if (send(index, options.timeout, time(NULL))) {
+			key.lastSent= now;
+			sent++;
+		}
+	});
+
+	elapsed= (nowNanos() - start) / 1e9;
+
+	readDrops(options.simplePort, &simpleDrops);
+	readDrops(options.signedPort, &signedDrops);
+	simpleDrops-= simpleDropsBefore;
+	signedDrops-= signedDropsBefore;
+
+	// Clean up everything that's still alive, at the same rate
+	std::vector<int> remaining;
+	int dyingCount= 0;
+	int64_t lastDeadline= 0;
+
+	for (size_t i= 0; i < keys.size(); i++) {
+		if (keys[i].lastSent == 0) {
+			continue;
+		}
+		if (keys[i].dying) {
+			dyingCount++;
+			int64_t deadline= keys[i].lastSent +
+				(int64_t)options.timeout * 1000000000LL;
+			lastDeadline= std::max(lastDeadline, deadline);
+		} else {
+			remaining.push_back(i);
+		}
+	}
+
+	pace(nowNanos(), remaining.size(), 0,
+		[this, &remaining](uint64_t slot)
+	{
+		send(remaining[slot], 0, time(NULL));
+	});
+
+	if (reader != NULL) {
+		int64_t waitUntil= lastDeadline +
+			(int64_t)GRACE_SECONDS * 1000000000LL;
+
+		while ((dyingExpired < dyingCount) && (nowNanos() < waitUntil)) {
+			usleep(10000);
+		}
+
+		shutdown(eventFd, SHUT_RDWR);
+		reader->join();
+		delete reader;
+		reader= NULL;
+		close(eventFd);
+	}
+}
+
+static void printDrops(char const *name, int port, bool bound,
+	unsigned long drops)
+{
+	if (bound) {
+		printf("Kernel drops on %s port %d: %lu\n", name, port, drops);
+	} else {
+		printf("Nothing was listening on %s port %d\n", name, port);
+	}
+}
+
+void Generator::report()
+{
+	int simpleKeys= 0;
+	for (Key const &key : keys) {
+		if (!key.isSigned) {
+			simpleKeys++;
+		}
+	}
+
+	printf("Sent %lu packets in %.1f s: %.0f/s, target %.0f/s, "
+		"%lu send errors\n",
+		sent, elapsed, sent / elapsed, options.rate, sendErrors);
+	printf("Each key refreshed every %.2f s with a %d s timeout\n",
+		keys.size() / options.rate, options.timeout);
+
+	if (simpleKeys > 0) {
+		printDrops("simple", options.simplePort, simpleBound, simpleDrops);
+	}
+	if (simpleKeys < (int)keys.size()) {
+		printDrops("signed", options.signedPort, signedBound, signedDrops);
+	}
+
+	if (options.eventPath == NULL) {
+		printf("No event socket given, so timeouts weren't measured\n");
+		return;
+	}
+
+	std::vector<double> latencies;
+	int dying= 0;
+	int unexpected= 0;
+
+	for (Key const &key : keys) {
+		int early= key.expireCount;
+
+		if (key.dying && (key.lastSent != 0)) {
+			dying++;
+			if (key.detected) {
+				int64_t deadline= key.lastSent +
+					(int64_t)options.timeout * 1000000000LL;
+				latencies.push_back((key.expiredAt - deadline) / 1e6);
+				early--;
+			}
+		}
+
+		if (early > 0) {
+			unexpected++;
+		}
+	}
+
+	printf("Dying keys: %d, expired %d, missed %d\n",
+		dying, (int)latencies.size(), dying - (int)latencies.size());
+	printf("Keys that expired while still being refreshed: %d\n",
+		unexpected);
+	if (eventsDropped > 0) {
+		printf("Events dropped by the event socket: %lu\n", eventsDropped);
+	}
+
+	if (!latencies.empty()) {
+		std::sort(latencies.begin(), latencies.end());
+
+		double const quantiles[]= { 0.5, 0.9, 0.99, 0.999 };
+		printf("Detection latency in ms, deadline to event:\n");
+		printf("    min %.1f", latencies.front());
+		for (double quantile : quantiles) {
+			size_t rank= (size_t)ceil(quantile * latencies.size());
+			printf("  p%g %.1f", quantile * 100,
+				latencies[(rank > 0) ? rank - 1 : 0]);
+		}
+		printf("  max %.1f\n", latencies.back());
+	}
+}
+
+int main(int argc, char* argv[])
+{
+	Options options;
+	options.address= "127.0.0.1";
+	options.simplePort= KEEPALIVE_SIMPLE_PORT;
+	options.signedPort= KEEPALIVE_SIGNED_PORT;
+	options.preSharedKey= NULL;
+	options.keyCount= 10000;
+	options.interval= 1;
+	options.rate= 0;
+	options.timeout= 5;
+	options.signedFraction= 0;
+	options.dyingFraction= 0.01;
+	options.duration= 30;
+	options.prefix= "bench.";
+	options.eventPath= NULL;
+
+	int c;
+	while ((c= getopt(argc, argv, "a:p:P:K:k:i:r:t:m:d:T:x:S:")) != -1) {
+		switch (c) {
+		case 'a':
+			options.address= optarg;
+			break;
+
+		case 'p':
+			options.simplePort= atoi(optarg);
+			break;
+
+		case 'P':
+			options.signedPort= atoi(optarg);
+			break;
+
+		case 'K':
+			options.preSharedKey= optarg;
+			break;
+
+		case 'k':
+			options.keyCount= atoi(optarg);
+			break;
+
+		case 'i':
+			options.interval= atof(optarg);
+			break;
+
+		case 'r':
+			options.rate= atof(optarg);
+			break;
+
+		case 't':
+			options.timeout= atoi(optarg);
+			break;
+
+		case 'm':
+			options.signedFraction= atof(optarg);
+			break;
+
+		case 'd':
+			options.dyingFraction= atof(optarg);
+			break;
+
+		case 'T':
+			options.duration= atoi(optarg);
+			break;
+
+		case 'x':
+			options.prefix= optarg;
+			break;
+
+		case 'S':
+			options.eventPath= optarg;
+			break;
+
+		default:
+			fprintf(stderr, "Unknown argument %c\n", optopt);
+			exit(1);
+		}
+	}
+
+	if ((options.keyCount < 1) || (options.interval <= 0) ||
+		(options.rate < 0) || (options.timeout < 1) ||
+		(options.duration < 1))
+	{
+		fprintf(stderr, "Counts and times must be positive\n");
+		exit(1);
+	}
+	if ((options.signedFraction < 0) || (options.signedFraction > 1) ||
+		(options.dyingFraction < 0) || (options.dyingFraction > 1))
+	{
+		fprintf(stderr, "Fractions must be between 0 and 1\n");
+		exit(1);
+	}
+	if ((options.signedFraction > 0) && (options.preSharedKey == NULL)) {
+		fprintf(stderr, "Signed packets need a pre-shared key with -K\n");
+		exit(1);
+	}
+
+	std::string sample= options.prefix;
+	sample.append("0");
+	if (!KeepalivePacket::ValidKey(sample.c_str())) {
+		fprintf(stderr, "Invalid key prefix %s\n", options.prefix);
+		exit(1);
+	}
+
+	if (options.rate == 0) {
+		options.rate= options.keyCount / options.interval;
+	}
+	if (options.keyCount / options.rate >= options.timeout) {
+		fprintf(stderr, "Warning: keys are refreshed every %.2f s, which "
+			"isn't inside the %d s timeout\n",
+			options.keyCount / options.rate, options.timeout);
+	}
+
+	Generator generator(options);
+	if (!generator.start()) {
+		exit(1);
+	}
+
+	generator.run();
+	generator.report();
+
+	return 0;
+}
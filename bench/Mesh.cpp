@@ -0,0 +1,622 @@
+#include "system.h"
+
+#include "Log.h"
+#include "Entry.h"
+#include "Receiver.h"
+#include "Scheduler.h"
+#include "Clock.h"
+#include "Listener.h"
+#include "UdpListener.h"
+#include "SimpleListener.h"
+#include "SignedListener.h"
+#include "KeepalivePacket.h"
+
+/*
+ * Mesh simulator.  This runs a whole deployment of timeoutd nodes in one
+ * process: each node has its own scheduler and listener, and sends its
+ * "node.N" keepalive to its peers the way the built-in sender does.
+ * Packets go through an in-memory transport with loss, latency and
+ * partitions instead of the network, and everything runs on a virtual
+ * clock, so minutes of a 500 node mesh take seconds.
+ *
+ * Usage: timeoutd-mesh [-n nodes] [-m] [-p peers] [-F frequency]
+ *     [-T timeout] [-D seconds] [-l loss] [-d min,max] [-P start,len,frac]
+ *     [-f failures] [-r resolution] [-K psk] [-s seed]
+ *
+ * With -m every node multicasts to all of the others.  -p gives each node
+ * that many unicast peers picked at random, and without either every node
+ * sends to every other one.  -f nodes crash at random times in the second
+ * quarter of the run, and -P cuts the first fraction of the nodes off from
+ * the rest for a while.
+ *
+ * Schedulers are checked for expiries every -r milliseconds, so detection
+ * times are rounded up to that.  It reports the packet rates, the load on
+ * each node's scheduler, how many notifications the mesh produced, and
+ * how long it took to notice the crashes.
+ */
+
+#define MICROS 1000000LL
+
+// Where the virtual clock starts, well away from zero
+#define START_MICROS (1000000LL * MICROS)
+
+// The listener handlers are protected, since normally only the listen
+// thread calls them.  No socket is opened unless start() is called.
+template <class Base>
+class MeshListener : public Base {
+public:
+	MeshListener(ReceiverRef receiver, int port) :
+		Base(receiver, AF_INET, port, false)
+	{
+	}
+
+	using Base::handlePacket;
+};
+
+struct MeshOptions {
+	int nodeCount;
+	bool multicast;
+	int peerCount;
+	int frequency;
+	int timeout;
+	int duration;
+	double loss;
+	double minLatencyMs;
+	double maxLatencyMs;
+	double partitionStart;
+	double partitionLength;
+	double partitionFraction;
+	int failures;
+	int resolutionMs;
+	char const *preSharedKey;
+	unsigned long seed;
+};
+
+struct MeshNode {
+	SchedulerRef scheduler;
+	std::function<void(char const *, socklen_t, char const *)> handlePacket;
+
+	std::string address;
+
+	// Packets can't be copied, so they're kept out of the vector
+	std::shared_ptr<KeepalivePacket> packet;
+	std::vector<int> peers;
+
+	// When the node crashes, or zero if it doesn't
+	int64_t crashAt;
+
+	unsigned long packetsReceived;
+	unsigned long notifications;
+	int maxEntries;
+
+	// Notifications for nodes that had crashed
+	int detected;
+};
+
+enum MeshEventKind {
+	EVENT_SEND,
+	EVENT_DELIVER,
+	EVENT_TICK
+};
+
+struct MeshEvent {
+	int64_t at;
+	MeshEventKind kind;
+	int node;
+	int source;
+
+	bool operator>(MeshEvent const &other) const {
+		return at > other.at;
+	}
+};
+
+class Mesh {
+public:
+	Mesh(MeshOptions const &options);
+
+	void run();
+	void report(double elapsed);
+
+private:
+	MeshOptions options;
+
+	VirtualClockRef clock;
+	std::vector<MeshNode> nodes;
+
+	std::priority_queue<MeshEvent, std::vector<MeshEvent>,
+		std::greater<MeshEvent>> events;
+
+	std::mt19937_64 random;
+	std::uniform_real_distribution<double> unit;
+
+	int64_t partitionStart;
+	int64_t partitionEnd;
+	int partitionSize;
+
+	unsigned long packetsSent;
+	unsigned long deliveries;
+	unsigned long lost;
+	unsigned long partitioned;
+
+	unsigned long falseNotifications;
+	std::vector<double> detections;
+
+	EntryBatch expired;
+
+	bool crashed(int node, int64_t now) {
+		return (nodes[node].crashAt != 0) && (now >= nodes[node].crashAt);
+	}
+
+	void push(int64_t at, MeshEventKind kind, int node, int source);
+	void send(int64_t now, int node);
+	void transmit(int64_t now, int source, int destination);
+	void deliver(int64_t now, int node, int source);
+	void tick(int64_t now);
+};
+
+Mesh::Mesh(MeshOptions const &options) :
+	options(options), random(options.seed), unit(0, 1)
+{
+	clock= VirtualClock::Create(START_MICROS);
+
+	partitionStart= START_MICROS +
+		(int64_t)(options.partitionStart * MICROS);
+	partitionEnd= partitionStart +
+		(int64_t)(options.partitionLength * MICROS);
+	partitionSize= (int)(options.partitionFraction * options.nodeCount);
+
+	packetsSent= 0;
+	deliveries= 0;
+	lost= 0;
+	partitioned= 0;
+	falseNotifications= 0;
+
+	nodes.resize(options.nodeCount);
+
+	for (int i= 0; i < options.nodeCount; i++) {
+		MeshNode& node= nodes[i];
+
+		// Everybody knows about everybody, as with a full peer file
+		node.scheduler= Scheduler::Create(options.nodeCount);
+		node.scheduler->setClock(clock);
+
+		node.packet= std::make_shared<KeepalivePacket>();
+
+		if (options.preSharedKey == NULL) {
+			auto listener= std::make_shared<MeshListener<SimpleListener>>(
+				node.scheduler, KEEPALIVE_SIMPLE_PORT);
+			node.handlePacket= [listener](char const *data,
+				socklen_t dataLen, char const *address)
+			{
+				listener->handlePacket(data, dataLen, address);
+			};
+		} else {
+			auto listener= std::make_shared<MeshListener<SignedListener>>(
+				node.scheduler, KEEPALIVE_SIGNED_PORT);
+			listener->addPreSharedKey(options.preSharedKey);
+			node.handlePacket= [listener](char const *data,
+				socklen_t dataLen, char const *address)
+			{
+				listener->handlePacket(data, dataLen, address);
+			};
+
+			node.packet->setPreSharedKey(options.preSharedKey);
+		}
+
+		char buffer[64];
+		snprintf(buffer, sizeof(buffer), "10.%d.%d.%d",
+			(i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff);
+		node.address= buffer;
+
+		snprintf(buffer, sizeof(buffer), "node.%d", i);
+		node.packet->setRecord(buffer, options.timeout);
+
+		node.crashAt= 0;
+		node.packetsReceived= 0;
+		node.notifications= 0;
+		node.maxEntries= 0;
+		node.detected= 0;
+
+		if (options.peerCount > 0) {
+			std::set<int> picked;
+			while ((int)picked.size() < options.peerCount) {
+				int peer= random() % options.nodeCount;
+				if (peer != i) {
+					picked.insert(peer);
+				}
+			}
+			node.peers.assign(picked.begin(), picked.end());
+		} else if (!options.multicast) {
+			for (int peer= 0; peer < options.nodeCount; peer++) {
+				if (peer != i) {
+					node.peers.push_back(peer);
+				}
+			}
+		}
+
+		// Nodes start at random times within one send period
+		push(START_MICROS + (int64_t)(unit(random) *
+			options.frequency * MICROS), EVENT_SEND, i, i);
+	}
+
+	int64_t durationMicros= (int64_t)options.duration * MICROS;
+
+	for (int crashes= 0; crashes < options.failures; ) {
+		MeshNode& node= nodes[random() % options.nodeCount];
+		if (node.crashAt == 0) {
+			node.crashAt= START_MICROS + (durationMicros / 4) +
+				(int64_t)(unit(random) * durationMicros / 4);
+			crashes++;
+		}
+	}
+
+	push(START_MICROS, EVENT_TICK, 0, 0);
+}
+
+void Mesh::push(int64_t at, MeshEventKind kind, int node, int source)
+{
+	MeshEvent event;
+	event.at= at;
+	event.kind= kind;
+	event.node= node;
+	event.source= source;
+
+	events.push(event);
+}
+
+void Mesh::transmit(int64_t now, int source, int destination)
+{
+	bool sourceInside= (source < partitionSize);
+	bool destinationInside= (destination < partitionSize);
+
+	if ((now >= partitionStart) && (now < partitionEnd) &&
+		(sourceInside != destinationInside))
+	{
+		partitioned++;
+	} else if (unit(random) < options.loss) {
+		lost++;
+	} else {
+		double latencyMs= options.minLatencyMs + unit(random) *
+			(options.maxLatencyMs - options.minLatencyMs);
+		push(now + (int64_t)(latencyMs * 1000), EVENT_DELIVER,
+			destination, source);
+	}
+}
+
+void Mesh::send(int64_t now, int node)
+{
+	if (crashed(node, now)) {
+		return;
+	}
+
+	MeshNode& sender= nodes[node];
+	sender.packet->refresh(time(NULL));
+
+	// A multicast packet is sent once and arrives everywhere
+	if (options.multicast) {
+		packetsSent++;
+		for (int i= 0; i < options.nodeCount; i++) {
+			if (i != node) {
+				transmit(now, node, i);
+			}
+		}
+	}
+
+	for (int peer : sender.peers) {
+		packetsSent++;
+		transmit(now, node, peer);
+	}
+
+	push(now + (int64_t)options.frequency * MICROS, EVENT_SEND, node, node);
+}
+
+void Mesh::deliver(int64_t now, int node, int source)
+{
+	if (crashed(node, now)) {
+		return;
+	}
+
+	MeshNode& receiver= nodes[node];
+	KeepalivePacket& packet= *nodes[source].packet;
+
+	receiver.handlePacket((char const *)packet.getData(),
+		packet.getLength(), nodes[source].address.c_str());
+	receiver.packetsReceived++;
+	deliveries++;
+}
+
+void Mesh::tick(int64_t now)
+{
+	for (int i= 0; i < options.nodeCount; i++) {
+		if (crashed(i, now)) {
+			continue;
+		}
+
+		MeshNode& node= nodes[i];
+
+		expired.clear();
+		node.scheduler->expireDue(expired);
+
+		for (EntryRef entry : expired) {
+			int source= atoi(entry->getKey() + strlen("node."));
+
+			node.notifications++;
+			if (crashed(source, now)) {
+				node.detected++;
+				detections.push_back(
+					(now - nodes[source].crashAt) / 1e6);
+			} else {
+				falseNotifications++;
+			}
+		}
+
+		node.maxEntries= std::max(node.maxEntries,
+			node.scheduler->getEntryCount());
+	}
+
+	push(now + options.resolutionMs * 1000, EVENT_TICK, 0, 0);
+}
+
+void Mesh::run()
+{
+	int64_t end= START_MICROS + (int64_t)options.duration * MICROS;
+
+	while (!events.empty() && (events.top().at <= end)) {
+		MeshEvent event= events.top();
+		events.pop();
+
+		clock->set(event.at);
+
+		switch (event.kind) {
+		case EVENT_SEND:
+			send(event.at, event.node);
+			break;
+
+		case EVENT_DELIVER:
+			deliver(event.at, event.node, event.source);
+			break;
+
+		case EVENT_TICK:
+			tick(event.at);
+			break;
+		}
+	}
+}
+
+// Print min, mean and max of a per-node figure over the nodes still up
+static void printSpread(char const *name, std::vector<double> const &values)
+{
+	if (values.empty()) {
+		return;
+	}
+
+	double total= 0;
+	for (double value : values) {
+		total+= value;
+	}
+
+	printf("    %-24s min %10.1f  mean %10.1f  max %10.1f\n", name,
+		*std::min_element(values.begin(), values.end()),
+		total / values.size(),
+		*std::max_element(values.begin(), values.end()));
+}
+
+void Mesh::report(double elapsed)
+{
+	double seconds= options.duration;
+
+	printf("Simulated %d s of %d nodes in %.1f s\n",
+		options.duration, options.nodeCount, elapsed);
+
+	printf("Packets sent %.0f/s, delivered %.0f/s, lost %lu, "
+		"cut off by the partition %lu\n",
+		packetsSent / seconds, deliveries / seconds, lost, partitioned);
+
+	std::vector<double> received;
+	std::vector<double> indexOperations;
+	std::vector<double> entries;
+	std::vector<double> notifications;
+	int64_t end= START_MICROS + (int64_t)options.duration * MICROS;
+
+	for (int i= 0; i < options.nodeCount; i++) {
+		if (crashed(i, end)) {
+			continue;
+		}
+
+		MeshNode& node= nodes[i];
+		received.push_back(node.packetsReceived / seconds);
+		indexOperations.push_back(
+			node.scheduler->getIndexOperations() / seconds);
+		entries.push_back(node.maxEntries);
+		notifications.push_back(node.notifications);
+	}
+
+	printf("Per node, over the %d nodes still up:\n", (int)received.size());
+	printSpread("packets received/s", received);
+	printSpread("index operations/s", indexOperations);
+	printSpread("most entries", entries);
+	printSpread("notifications", notifications);
+
+	printf("Notifications: %lu for crashed nodes, %lu for nodes still up\n",
+		(unsigned long)detections.size(), falseNotifications);
+
+	// Every node a crashed node was sending to should have noticed, if
+	// it's still up itself
+	int expected= 0;
+	int noticed= 0;
+
+	for (int i= 0; i < options.nodeCount; i++) {
+		if (crashed(i, end)) {
+			continue;
+		}
+		noticed+= nodes[i].detected;
+
+		for (int j= 0; j < options.nodeCount; j++) {
+			if ((j != i) && crashed(j, end) &&
+				(options.multicast ||
+				std::binary_search(nodes[j].peers.begin(),
+					nodes[j].peers.end(), i)))
+			{
+				expected++;
+			}
+		}
+	}
+
+	printf("Crashes noticed %d times by nodes still up, of %d expected\n",
+		noticed, expected);
+
+	if (!detections.empty()) {
+		std::sort(detections.begin(), detections.end());
+
+		double const quantiles[]= { 0.5, 0.9, 0.99 };
+		printf("Time from crash to notification in s:\n");
+		printf("    min %.2f", detections.front());
+		for (double quantile : quantiles) {
+			size_t rank= (size_t)ceil(quantile * detections.size());
+			printf("  p%g %.2f", quantile * 100,
+				detections[(rank > 0) ? rank - 1 : 0]);
+		}
+		printf("  max %.2f\n", detections.back());
+	}
+}
+
+static double nowSeconds()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + (ts.tv_nsec / 1e9);
+}
+
+int main(int argc, char* argv[])
+{
+	MeshOptions options;
+	options.nodeCount= 500;
+	options.multicast= false;
+	options.peerCount= 0;
+	options.frequency= 2;
+	options.timeout= 10;
+	options.duration= 60;
+	options.loss= 0;
+	options.minLatencyMs= 0.1;
+	options.maxLatencyMs= 1;
+	options.partitionStart= 0;
+	options.partitionLength= 0;
+	options.partitionFraction= 0;
+	options.failures= 5;
+	options.resolutionMs= 100;
+	options.preSharedKey= NULL;
+	options.seed= 42;
+
+	int c;
+	while ((c= getopt(argc, argv, "n:mp:F:T:D:l:d:P:f:r:K:s:")) != -1) {
+		switch (c) {
+		case 'n':
+			options.nodeCount= atoi(optarg);
+			break;
+
+		case 'm':
+			options.multicast= true;
+			break;
+
+		case 'p':
+			options.peerCount= atoi(optarg);
+			break;
+
+		case 'F':
+			options.frequency= atoi(optarg);
+			break;
+
+		case 'T':
+			options.timeout= atoi(optarg);
+			break;
+
+		case 'D':
+			options.duration= atoi(optarg);
+			break;
+
+		case 'l':
+			options.loss= atof(optarg);
+			break;
+
+		case 'd':
+			if (sscanf(optarg, "%lf,%lf", &options.minLatencyMs,
+				&options.maxLatencyMs) != 2)
+			{
+				fprintf(stderr, "Latency must be min,max in ms\n");
+				exit(1);
+			}
+			break;
+
+		case 'P':
+			if (sscanf(optarg, "%lf,%lf,%lf", &options.partitionStart,
+				&options.partitionLength,
+				&options.partitionFraction) != 3)
+			{
+				fprintf(stderr,
+					"Partition must be start,length,fraction\n");
+				exit(1);
+			}
+			break;
+
+		case 'f':
+			options.failures= atoi(optarg);
+			break;
+
+		case 'r':
+			options.resolutionMs= atoi(optarg);
+			break;
+
+		case 'K':
+			options.preSharedKey= optarg;
+			break;
+
+		case 's':
+			options.seed= strtoul(optarg, NULL, 10);
+			break;
+
+		default:
+			fprintf(stderr, "Unknown argument %c\n", optopt);
+			exit(1);
+		}
+	}
+
+	if ((options.nodeCount < 2) || (options.frequency < 1) ||
+		(options.timeout < 1) || (options.duration < 1) ||
+		(options.resolutionMs < 1))
+	{
+		fprintf(stderr, "Counts and times must be positive\n");
+		exit(1);
+	}
+	if ((options.peerCount < 0) || (options.peerCount >= options.nodeCount)) {
+		fprintf(stderr, "Peers must be fewer than the nodes\n");
+		exit(1);
+	}
+	if ((options.failures < 0) || (options.failures > options.nodeCount)) {
+		fprintf(stderr, "Failures can't be more than the nodes\n");
+		exit(1);
+	}
+	if ((options.loss < 0) || (options.loss > 1) ||
+		(options.partitionFraction < 0) || (options.partitionFraction > 1))
+	{
+		fprintf(stderr, "Fractions must be between 0 and 1\n");
+		exit(1);
+	}
+	if ((options.minLatencyMs < 0) ||
+		(options.maxLatencyMs < options.minLatencyMs))
+	{
+		fprintf(stderr, "Invalid latency range\n");
+		exit(1);
+	}
+
+	// The schedulers log removals and quota problems, which aren't what
+	// we're timing
+	Log::setLogLevel(LOG_ERROR);
+
+	double start= nowSeconds();
+
+	Mesh mesh(options);
+	mesh.run();
+	mesh.report(nowSeconds() - start);
+
+	return 0;
+}
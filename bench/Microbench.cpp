@@ -0,0 +1,590 @@
+#include "system.h"
+
+#include "Log.h"
+#include "Entry.h"
+#include "Receiver.h"
+#include "Scheduler.h"
+#include "Notifier.h"
+#include "ScriptNotifier.h"
+#include "Listener.h"
+#include "UdpListener.h"
+#include "SimpleListener.h"
+#include "SignedListener.h"
+#include "KeepalivePacket.h"
+
+/*
+ * Microbenchmarks for the hot paths in the daemon.  These drive the classes
+ * directly without any sockets or threads, so the numbers are the cost of
+ * the code itself and not the kernel.
+ *
+ * Usage: timeoutd-microbench [-k keys] [-r rounds] [-n spawns] [-o ops]
+ *     [name ...]
+ *
+ * With no names all of the benchmarks are run.  Benchmarks that sweep the
+ * number of keys start at 1000 and go up by ten times to the -k count.
+ *
+ * Every allocation in the process is counted, including OpenSSL's, so each
+ * benchmark can report how many allocations it makes per operation as well
+ * as how long it takes.
+ */
+
+static std::atomic<unsigned long> allocations(0);
+
+void *operator new(size_t size)
+{
+	allocations.fetch_add(1, std::memory_order_relaxed);
+
+	void *rval= malloc(size ? size : 1);
+	if (rval == NULL) {
+		throw std::bad_alloc();
+	}
+	return rval;
+}
+
+void operator delete(void *pointer) noexcept
+{
+	free(pointer);
+}
+
+void operator delete(void *pointer, size_t) noexcept
+{
+	free(pointer);
+}
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+static void *countingMalloc(size_t size, char const *, int)
+{
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	return malloc(size);
+}
+
+static void *countingRealloc(void *pointer, size_t size, char const *, int)
+{
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	return realloc(pointer, size);
+}
+
+static void countingFree(void *pointer, char const *, int)
+{
+	free(pointer);
+}
+#endif
+
+static unsigned long allocationCount()
+{
+	return allocations.load(std::memory_order_relaxed);
+}
+
+static double nowNanos()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec * 1e9) + ts.tv_nsec;
+}
+
+static void makeKeys(std::vector<std::string>& keys, int count)
+{
+	keys.clear();
+	keys.reserve(count);
+
+	char buffer[32];
+	for (int i= 0; i < count; i++) {
+		snprintf(buffer, sizeof(buffer), "bench.%d", i);
+		keys.push_back(buffer);
+	}
+}
+
+/*
+ * Refresh: every key is created and then refreshed a number of times with
+ * the same timeout, which is what a healthy sender looks like.  This is
+ * run with and without lazy rescheduling to compare how many operations
+ * on the timeout index each packet costs.
+ *
+ * The timeout is long enough that nothing expires, so with lazy
+ * rescheduling this doesn't include the one requeue per key per timeout
+ * period that the scheduling thread does when it reaches a stale entry.
+ */
+static void benchRefresh(int keyCount, int rounds, bool lazy)
+{
+	std::vector<std::string> keys;
+	makeKeys(keys, keyCount);
+
+	SchedulerRef scheduler= Scheduler::Create(keyCount);
+	scheduler->setLazyRescheduling(lazy);
+
+	for (std::string const &key : keys) {
+		scheduler->receive(key.c_str(), NULL, 3600, "127.0.0.1");
+	}
+
+	unsigned long startOps= scheduler->getIndexOperations();
+	double start= nowNanos();
+
+	for (int round= 0; round < rounds; round++) {
+		for (std::string const &key : keys) {
+			scheduler->receive(key.c_str(), NULL, 3600, "127.0.0.1");
+		}
+	}
+
+	double elapsed= nowNanos() - start;
+	unsigned long ops= scheduler->getIndexOperations() - startOps;
+	double packets= (double)keyCount * rounds;
+
+	printf("%-28s %10d keys %10.1f ns/op %6.2f index ops/op\n",
+		lazy ? "refresh (lazy)" : "refresh (eager)",
+		keyCount, elapsed / packets, ops / packets);
+}
+
+// Key counts to sweep: 1000, 10000 and so on up to the limit
+static void keySizes(std::vector<int>& sizes, int keyCount)
+{
+	sizes.clear();
+	for (int size= 1000; size < keyCount; size*= 10) {
+		sizes.push_back(size);
+	}
+	sizes.push_back(keyCount);
+}
+
+/*
+ * Receive: a mix of creates, refreshes and removals against a scheduler
+ * that already holds the given number of keys.  Half of a pool of twice
+ * that many keys is live to start with, creates pick one of the others and
+ * removals pick a live one, so the table stays around the same size.
+ *
+ * The operations are drawn up front from a fixed seed, so runs can be
+ * compared and the random numbers aren't timed.
+ */
+struct ReceiveMix {
+	char const *name;
+	int createPercent;
+	int removePercent;
+};
+
+static ReceiveMix const receiveMixes[]= {
+	{ "receive (defer)", 0, 0 },
+	{ "receive (90/5/5)", 5, 5 },
+	{ "receive (churn)", 50, 50 },
+};
+
+enum ReceiveOp {
+	OP_CREATE,
+	OP_DEFER,
+	OP_REMOVE
+};
+
+static void benchReceive(int keyCount, int opCount, ReceiveMix const &mix)
+{
+	std::vector<std::string> keys;
+	makeKeys(keys, keyCount * 2);
+
+	std::vector<int> live;
+	std::vector<int> dead;
+	for (int i= 0; i < keyCount; i++) {
+		live.push_back(i);
+		dead.push_back(keyCount + i);
+	}
+
+	// Each operation is the kind in the low two bits and the key index
+	// above that.
+	std::vector<uint32_t> ops;
+	ops.reserve(opCount);
+
+	std::mt19937 random(42);
+	for (int i= 0; i < opCount; i++) {
+		int roll= random() % 100;
+		ReceiveOp op= OP_DEFER;
+
+		if ((roll < mix.createPercent) && !dead.empty()) {
+			op= OP_CREATE;
+		} else if ((roll >= 100 - mix.removePercent) && !live.empty()) {
+			op= OP_REMOVE;
+		} else if (live.empty()) {
+			// Churn can remove everything, leaving nothing to refresh
+			op= OP_CREATE;
+		}
+
+		std::vector<int>& from= (op == OP_CREATE) ? dead : live;
+		size_t pick= random() % from.size();
+		int index= from[pick];
+
+		if (op != OP_DEFER) {
+			from[pick]= from.back();
+			from.pop_back();
+			((op == OP_CREATE) ? live : dead).push_back(index);
+		}
+
+		ops.push_back(((uint32_t)index << 2) | op);
+	}
+
+	SchedulerRef scheduler= Scheduler::Create(keyCount * 2);
+	for (int i= 0; i < keyCount; i++) {
+		scheduler->receive(keys[i].c_str(), NULL, 3600, "127.0.0.1");
+	}
+
+	unsigned long startAllocations= allocationCount();
+	double start= nowNanos();
+
+	for (uint32_t op : ops) {
+		scheduler->receive(keys[op >> 2].c_str(), NULL,
+			((op & 3) == OP_REMOVE) ? 0 : 3600, "127.0.0.1");
+	}
+
+	double elapsed= nowNanos() - start;
+	unsigned long allocated= allocationCount() - startAllocations;
+
+	printf("%-28s %10d keys %10.1f ns/op %6.2f allocs/op\n",
+		mix.name, keyCount, elapsed / opCount,
+		(double)allocated / opCount);
+}
+
+/*
+ * Expire: load keys with a one second timeout, wait until they're all
+ * due, then start the scheduling thread and time how long it takes to
+ * expire every one of them.  There's no router, so this is the cost of
+ * the scheduler finding and removing entries, not of notifying anybody.
+ *
+ * The entry count is polled every 50us, which limits how precise the
+ * smallest runs are.
+ */
+static void benchExpire(int keyCount)
+{
+	std::vector<std::string> keys;
+	makeKeys(keys, keyCount);
+
+	SchedulerRef scheduler= Scheduler::Create(keyCount);
+	for (std::string const &key : keys) {
+		scheduler->receive(key.c_str(), NULL, 1, "127.0.0.1");
+	}
+
+	usleep(1100000);
+
+	unsigned long startAllocations= allocationCount();
+	double start= nowNanos();
+
+	scheduler->start();
+	while (scheduler->getEntryCount() > 0) {
+		usleep(50);
+	}
+
+	double elapsed= nowNanos() - start;
+	unsigned long allocated= allocationCount() - startAllocations;
+
+	scheduler->stop();
+
+	printf("%-28s %10d keys %10.1f ns/op %6.2f allocs/op\n",
+		"expire", keyCount, elapsed / keyCount,
+		(double)allocated / keyCount);
+}
+
+// Takes records and does nothing with them, so only the decoding is timed
+class NullReceiver : public Receiver {
+public:
+	unsigned long records;
+
+	NullReceiver() {
+		records= 0;
+	}
+
+	virtual void receive(char const *, char const *, int, char const *) {
+		records++;
+	}
+};
+
+// The listeners' packet handlers are protected, since normally only the
+// listen thread calls them.  No socket is opened unless start() is called.
+class BenchSimpleListener : public SimpleListener {
+public:
+	BenchSimpleListener(ReceiverRef receiver) :
+		SimpleListener(receiver, AF_INET, KEEPALIVE_SIMPLE_PORT, false)
+	{
+	}
+
+	using SimpleListener::handlePacket;
+};
+
+class BenchSignedListener : public SignedListener {
+public:
+	BenchSignedListener(ReceiverRef receiver) :
+		SignedListener(receiver, AF_INET, KEEPALIVE_SIGNED_PORT, false)
+	{
+	}
+
+	using SignedListener::handlePacket;
+};
+
+/*
+ * Parse: decode simple packets, one with a single record and one filled
+ * with as many records as fit, through the same handler the listen thread
+ * uses.
+ */
+static void benchParse(int opCount)
+{
+	std::shared_ptr<NullReceiver> receiver= std::make_shared<NullReceiver>();
+	BenchSimpleListener listener(receiver);
+
+	for (int full= 0; full < 2; full++) {
+		KeepalivePacket packet;
+		packet.setRecord("bench.0", 30);
+
+		if (full) {
+			char key[32];
+			for (int i= 1; ; i++) {
+				snprintf(key, sizeof(key), "bench.%d", i);
+				if (!packet.addRecord(key, 30)) {
+					break;
+				}
+			}
+		}
+
+		char const *data= (char const *)packet.getData();
+		socklen_t dataLen= packet.getLength();
+
+		unsigned long startAllocations= allocationCount();
+		double start= nowNanos();
+
+		for (int i= 0; i < opCount; i++) {
+			listener.handlePacket(data, dataLen, "127.0.0.1");
+		}
+
+		double elapsed= nowNanos() - start;
+		unsigned long allocated= allocationCount() - startAllocations;
+
+		char name[64];
+		snprintf(name, sizeof(name), "parse (%d record%s)",
+			packet.getRecordCount(), full ? "s" : "");
+
+		printf("%-28s %10d bytes %9.1f ns/op %6.2f allocs/op\n",
+			name, (int)dataLen, elapsed / opCount,
+			(double)allocated / opCount);
+	}
+}
+
+/*
+ * Verify: check signed single-record packets against one to four
+ * pre-shared keys.  The packets are signed with the last key, which is the
+ * worst case since the listener tries the keys in order.
+ */
+static void benchVerify(int opCount)
+{
+	std::shared_ptr<NullReceiver> receiver= std::make_shared<NullReceiver>();
+	char const *psks[]= { "bench1", "bench2", "bench3", "bench4" };
+
+	for (int keyCount= 1; keyCount <= 4; keyCount++) {
+		BenchSignedListener listener(receiver);
+		for (int i= 0; i < keyCount; i++) {
+			listener.addPreSharedKey(psks[i]);
+		}
+
+		KeepalivePacket packet;
+		packet.setPreSharedKey(psks[keyCount - 1]);
+		packet.setRecord("bench.0", 30);
+		packet.refresh(time(NULL));
+
+		char const *data= (char const *)packet.getData();
+		socklen_t dataLen= packet.getLength();
+
+		unsigned long startRecords= receiver->records;
+		unsigned long startAllocations= allocationCount();
+		double start= nowNanos();
+
+		for (int i= 0; i < opCount; i++) {
+			listener.handlePacket(data, dataLen, "127.0.0.1");
+		}
+
+		double elapsed= nowNanos() - start;
+		unsigned long allocated= allocationCount() - startAllocations;
+
+		if (receiver->records - startRecords != (unsigned long)opCount) {
+			fprintf(stderr, "Signed packets were rejected\n");
+			exit(1);
+		}
+
+		char name[64];
+		snprintf(name, sizeof(name), "verify (%d key%s)",
+			keyCount, (keyCount > 1) ? "s" : "");
+
+		printf("%-28s %10d bytes %9.1f ns/op %6.2f allocs/op\n",
+			name, (int)dataLen, elapsed / opCount,
+			(double)allocated / opCount);
+	}
+}
+
+// Resident set size in megabytes
+static double residentMegabytes()
+{
+	double rval= 0;
+
+	FILE *file= fopen("/proc/self/statm", "rt");
+	if (file != NULL) {
+		long size, resident;
+		if (fscanf(file, "%ld %ld", &size, &resident) == 2) {
+			rval= (double)resident * sysconf(_SC_PAGESIZE);
+			rval/= 1024 * 1024;
+		}
+		fclose(file);
+	}
+
+	return rval;
+}
+
+// This is how notification scripts used to be launched, kept here to
+// compare against.
+static void forkExecWait(char const *path)
+{
+	pid_t childPid= fork();
+	if (childPid == 0) {
+		execl(path, path, (char *)NULL);
+		_exit(99);
+	} else if (childPid > 0) {
+		int status;
+		while ((waitpid(childPid, &status, 0) == -1) && (errno == EINTR)) {
+		}
+	}
+}
+
+/*
+ * Spawn: time launching a notification with the scheduler holding a given
+ * number of entries, to show how the launch cost scales with the size of
+ * the process.  The notify script is /bin/true so this is all launch
+ * overhead.
+ */
+static void benchSpawn(int keyCount, int spawns)
+{
+	std::vector<std::string> keys;
+	makeKeys(keys, keyCount);
+
+	SchedulerRef scheduler= Scheduler::Create(keyCount);
+	for (std::string const &key : keys) {
+		scheduler->receive(key.c_str(), NULL, 3600, "127.0.0.1");
+	}
+
+	double rss= residentMegabytes();
+
+	double start= nowNanos();
+	for (int i= 0; i < spawns; i++) {
+		forkExecWait("/bin/true");
+	}
+	double forkElapsed= nowNanos() - start;
+
+	start= nowNanos();
+	for (int i= 0; i < spawns; i++) {
+		char const *childArgv[2]= { "/bin/true", NULL };
+
+		pid_t childPid;
+		if (ScriptNotifier::Spawn(childArgv, &childPid) == 0) {
+			int status;
+			while ((waitpid(childPid, &status, 0) == -1) &&
+				(errno == EINTR))
+			{
+			}
+		}
+	}
+	double spawnElapsed= nowNanos() - start;
+
+	printf("%-28s %10d keys %10.1f us/op %8.1f MB RSS\n",
+		"spawn (fork+exec)", keyCount,
+		forkElapsed / spawns / 1000, rss);
+	printf("%-28s %10d keys %10.1f us/op %8.1f MB RSS\n",
+		"spawn (posix_spawn)", keyCount,
+		spawnElapsed / spawns / 1000, rss);
+}
+
+static bool selected(int argc, char *argv[], char const *name)
+{
+	if (optind >= argc) {
+		return true;
+	}
+	for (int i= optind; i < argc; i++) {
+		if (strcmp(argv[i], name) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+int main(int argc, char* argv[])
+{
+	int keyCount= 100000;
+	int rounds= 10;
+	int spawns= 200;
+	int opCount= 1000000;
+
+	int c;
+	while ((c= getopt(argc, argv, "k:r:n:o:")) != -1) {
+		switch (c) {
+		case 'k':
+			keyCount= atoi(optarg);
+			break;
+
+		case 'r':
+			rounds= atoi(optarg);
+			break;
+
+		case 'n':
+			spawns= atoi(optarg);
+			break;
+
+		case 'o':
+			opCount= atoi(optarg);
+			break;
+
+		default:
+			fprintf(stderr, "Unknown argument %c\n", optopt);
+			exit(1);
+		}
+	}
+
+	if ((keyCount < 1) || (rounds < 1) || (spawns < 1) || (opCount < 1)) {
+		fprintf(stderr, "Counts must be positive\n");
+		exit(1);
+	}
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	// This only works before OpenSSL has allocated anything
+	if (!CRYPTO_set_mem_functions(
+		&countingMalloc, &countingRealloc, &countingFree))
+	{
+		fprintf(stderr, "Unable to count OpenSSL allocations\n");
+	}
+#endif
+
+	// The scheduler logs creation and quota problems - we don't want to
+	// time the logging.
+	Log::setLogLevel(LOG_ERROR);
+
+	if (selected(argc, argv, "refresh")) {
+		benchRefresh(keyCount, rounds, false);
+		benchRefresh(keyCount, rounds, true);
+	}
+
+	std::vector<int> sizes;
+	keySizes(sizes, keyCount);
+
+	if (selected(argc, argv, "receive")) {
+		for (ReceiveMix const &mix : receiveMixes) {
+			for (int size : sizes) {
+				benchReceive(size, opCount, mix);
+			}
+		}
+	}
+
+	if (selected(argc, argv, "expire")) {
+		for (int size : sizes) {
+			benchExpire(size);
+		}
+	}
+
+	if (selected(argc, argv, "parse")) {
+		benchParse(opCount);
+	}
+
+	if (selected(argc, argv, "verify")) {
+		benchVerify(opCount);
+	}
+
+	if (selected(argc, argv, "spawn")) {
+		benchSpawn(1, spawns);
+		benchSpawn(keyCount, spawns);
+	}
+
+	return 0;
+}
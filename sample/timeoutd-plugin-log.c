@@ -0,0 +1,55 @@
+/*
+ * Example notification plugin for use with -L.  It appends a line for each
+ * timeout to the file given as the plugin argument, writing each batch at
+ * once.
+ *
+ * Build with:
+ *
+ *     cc -shared -fPIC -I/usr/local/include/timeoutd \
+ *         -o timeoutd-plugin-log.so timeoutd-plugin-log.c
+ *
+ * and run with:
+ *
+ *     timeoutd -L /path/to/timeoutd-plugin-log.so,/var/log/timeouts
+ */
+
+#include <stdio.h>
+#include <time.h>
+
+#include "plugin.h"
+
+int timeoutd_plugin_init(int abi_version, char const *argument, void **state)
+{
+	FILE *file;
+
+	if (abi_version != TIMEOUTD_PLUGIN_ABI_VERSION) {
+		return 1;
+	}
+
+	file= fopen((argument != NULL) ? argument : "/dev/stderr", "a");
+	if (file == NULL) {
+		return 2;
+	}
+
+	*state= file;
+	return 0;
+}
+
+void timeoutd_plugin_notify(void *state,
+	struct timeoutd_expiry const *expiries, size_t count)
+{
+	FILE *file= (FILE *)state;
+	time_t now= time(NULL);
+	size_t i;
+
+	for (i= 0; i < count; i++) {
+		fprintf(file, "%ld timeout %s %s\n",
+			(long)now, expiries[i].key, expiries[i].address);
+	}
+	fflush(file);
+}
+
+void timeoutd_plugin_shutdown(void *state)
+{
+	fclose((FILE *)state);
+}
@@ -0,0 +1,92 @@
+#include "system.h"
+
+#include "Clock.h"
+
+// How often the scheduling thread looks at a virtual clock
+#define VIRTUAL_POLL_MS 1
+
+Clock::Clock()
+{
+}
+
+Clock::~Clock()
+{
+}
+
+MonotonicClock::MonotonicClock()
+{
+}
+
+MonotonicClock::~MonotonicClock()
+{
+}
+
+void MonotonicClock::now(struct timeval *now)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	now->tv_sec= ts.tv_sec;
+	now->tv_usec= ts.tv_nsec / 1000;
+}
+
+void MonotonicClock::wait(std::unique_lock<std::mutex>& lock,
+	std::condition_variable& wake, struct timeval const *deadline)
+{
+	if (deadline == NULL) {
+		wake.wait(lock);
+		return;
+	}
+
+	// steady_clock is CLOCK_MONOTONIC in the implementations we build
+	// with, so the deadline can be used as is.
+	auto d= std::chrono::seconds(deadline->tv_sec) +
+		std::chrono::microseconds(deadline->tv_usec);
+	std::chrono::steady_clock::time_point until{
+		std::chrono::duration_cast<
+		std::chrono::steady_clock::duration>(d)};
+
+	wake.wait_until(lock, until);
+}
+
+VirtualClock::VirtualClock(int64_t startMicros) :
+	micros(startMicros)
+{
+}
+
+VirtualClock::~VirtualClock()
+{
+}
+
+void VirtualClock::now(struct timeval *now)
+{
+	int64_t current= getMicros();
+
+	now->tv_sec= current / 1000000;
+	now->tv_usec= current % 1000000;
+}
+
+void VirtualClock::wait(std::unique_lock<std::mutex>& lock,
+	std::condition_variable& wake, struct timeval const *deadline)
+{
+	if (deadline == NULL) {
+		wake.wait(lock);
+	} else {
+		wake.wait_for(lock, std::chrono::milliseconds(VIRTUAL_POLL_MS));
+	}
+}
+
+void VirtualClock::set(int64_t micros)
+{
+	int64_t current= this->micros.load(std::memory_order_relaxed);
+	while ((micros > current) &&
+		!this->micros.compare_exchange_weak(current, micros,
+			std::memory_order_release))
+	{
+	}
+}
+
+void VirtualClock::advance(int64_t micros)
+{
+	this->micros.fetch_add(micros, std::memory_order_release);
+}
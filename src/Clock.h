@@ -0,0 +1,78 @@
+/**
+ * Clock
+ *
+ * Where the scheduler gets the time and how it waits for the next entry
+ * to come due.  Normally that's MonotonicClock, so a change to the
+ * system's wall clock doesn't expire entries early or hold them up.
+ * VirtualClock only moves when told to, so a simulation can run hours of
+ * keepalives through the scheduler in seconds.
+ */
+class Clock {
+public:
+	Clock();
+	virtual ~Clock();
+
+	virtual void now(struct timeval *now) = 0;
+
+	// Wait on the condition until it's notified or the clock reaches the
+	// deadline.  The lock is held on entry and on return.  A NULL
+	// deadline waits until notified.
+	virtual void wait(std::unique_lock<std::mutex>& lock,
+		std::condition_variable& wake, struct timeval const *deadline) = 0;
+};
+
+typedef std::shared_ptr<Clock> ClockRef;
+
+/**
+ * MonotonicClock
+ *
+ * CLOCK_MONOTONIC, which is what the daemon runs on.
+ */
+class MonotonicClock : public Clock {
+public:
+	MonotonicClock();
+	virtual ~MonotonicClock();
+
+	virtual void now(struct timeval *now);
+	virtual void wait(std::unique_lock<std::mutex>& lock,
+		std::condition_variable& wake, struct timeval const *deadline);
+
+	static std::shared_ptr<MonotonicClock> Create() {
+		return std::make_shared<MonotonicClock>();
+	}
+};
+
+/**
+ * VirtualClock
+ *
+ * A clock that stands still until advanced.  It's meant for driving the
+ * scheduler directly with Scheduler::expireDue() instead of running the
+ * scheduling thread.  If the thread is run against it anyway, the thread
+ * checks the clock every millisecond while it has something scheduled.
+ */
+class VirtualClock : public Clock {
+public:
+	VirtualClock(int64_t startMicros);
+	virtual ~VirtualClock();
+
+	virtual void now(struct timeval *now);
+	virtual void wait(std::unique_lock<std::mutex>& lock,
+		std::condition_variable& wake, struct timeval const *deadline);
+
+	int64_t getMicros() {
+		return micros.load(std::memory_order_acquire);
+	}
+
+	// Time only moves forward, so setting an earlier time does nothing
+	void set(int64_t micros);
+	void advance(int64_t micros);
+
+	static std::shared_ptr<VirtualClock> Create(int64_t startMicros) {
+		return std::make_shared<VirtualClock>(startMicros);
+	}
+
+private:
+	std::atomic<int64_t> micros;
+};
+
+typedef std::shared_ptr<VirtualClock> VirtualClockRef;
@@ -0,0 +1,197 @@
+#include "system.h"
+
+#include "Log.h"
+#include "Entry.h"
+#include "Notifier.h"
+#include "CoalescingNotifier.h"
+
+// A group this big is delivered without waiting for the window to close
+#define MAX_GROUP 1000
+
+CoalescingNotifier::CoalescingNotifier(NotifierRef target,
+	int window, GroupBy groupBy, int minimum)
+{
+	this->target= target;
+	this->window= window;
+	this->groupBy= groupBy;
+	this->minimum= minimum;
+
+	run= false;
+	thread= NULL;
+}
+
+CoalescingNotifier::~CoalescingNotifier()
+{
+}
+
+bool CoalescingNotifier::ParseGroupBy(char const *text, GroupBy *groupBy)
+{
+	if (strcmp(text, "prefix") == 0) {
+		*groupBy= GROUP_PREFIX;
+	} else if (strcmp(text, "subnet") == 0) {
+		*groupBy= GROUP_SUBNET;
+	} else {
+		return false;
+	}
+	return true;
+}
+
+bool CoalescingNotifier::start()
+{
+	if (!target->start()) {
+		return false;
+	}
+
+	run= true;
+	thread= new std::thread(&CoalescingNotifier::loop, this);
+
+	Log::log(LOG_DEBUG,
+		"Coalescing notifications within %d ms", window);
+
+	return true;
+}
+
+void CoalescingNotifier::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		run= false;
+	}
+	wake.notify_one();
+
+	thread->join();
+	delete thread;
+	thread= NULL;
+
+	target->stop();
+}
+
+void CoalescingNotifier::notify(EntryRef entry)
+{
+	notifyBatch(EntryBatch(1, entry));
+}
+
+void CoalescingNotifier::notifyBatch(EntryBatch const &batch)
+{
+	std::list<EntryBatch> full;
+	bool opened= false;
+	std::string key;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (EntryRef const &entry : batch) {
+			groupKey(entry, key);
+
+			auto groupIter= groups.find(key);
+			if (groupIter == groups.end()) {
+				Group group;
+				group.flushAt= std::chrono::steady_clock::now() +
+					std::chrono::milliseconds(window);
+
+				groupIter= groups.insert(std::make_pair(key, group)).first;
+				opened= true;
+			}
+
+			groupIter->second.entries.push_back(entry);
+
+			if (groupIter->second.entries.size() >= MAX_GROUP) {
+				full.push_back(groupIter->second.entries);
+				groups.erase(groupIter);
+			}
+		}
+	}
+
+	// A new group may close before whatever the flusher is waiting for
+	if (opened) {
+		wake.notify_one();
+	}
+
+	for (EntryBatch const &group : full) {
+		deliver(group);
+	}
+}
+
+void CoalescingNotifier::groupKey(EntryRef const &entry, std::string& key)
+{
+	key.clear();
+
+	if (groupBy == GROUP_PREFIX) {
+		char const *entryKey= entry->getKey();
+		char const *lastDot= strrchr(entryKey, '.');
+		if (lastDot != NULL) {
+			key.assign(entryKey, lastDot - entryKey);
+		} else {
+			key.assign(entryKey);
+		}
+	} else if (groupBy == GROUP_SUBNET) {
+		char const *address= entry->getLastAddress();
+		char text[INET6_ADDRSTRLEN];
+
+		struct in_addr addr4;
+		struct in6_addr addr6;
+
+		if (inet_pton(AF_INET, address, &addr4) == 1) {
+			addr4.s_addr&= htonl(0xffffff00);
+			inet_ntop(AF_INET, &addr4, text, sizeof(text));
+			key.assign(text);
+			key.append("/24");
+		} else if (inet_pton(AF_INET6, address, &addr6) == 1) {
+			memset(&addr6.s6_addr[8], 0, 8);
+			inet_ntop(AF_INET6, &addr6, text, sizeof(text));
+			key.assign(text);
+			key.append("/64");
+		} else {
+			key.assign(address);
+		}
+	}
+}
+
+void CoalescingNotifier::deliver(EntryBatch const &group)
+{
+	if ((int)group.size() >= minimum) {
+		Log::log(LOG_INFO, "Sending one notification for %d timeouts",
+			(int)group.size());
+		target->notifyGroup(group);
+	} else {
+		target->notifyBatch(group);
+	}
+}
+
+void CoalescingNotifier::loop()
+{
+	std::list<EntryBatch> ready;
+
+	std::unique_lock<std::mutex> lock(mutex);
+	for (;;) {
+		auto now= std::chrono::steady_clock::now();
+		auto nextFlush= now + std::chrono::hours(1);
+
+		// On the way out everything goes now
+		for (auto groupIter= groups.begin(); groupIter != groups.end(); ) {
+			auto current= groupIter++;
+
+			if (!run || (current->second.flushAt <= now)) {
+				ready.push_back(current->second.entries);
+				groups.erase(current);
+			} else if (current->second.flushAt < nextFlush) {
+				nextFlush= current->second.flushAt;
+			}
+		}
+
+		if (!ready.empty()) {
+			lock.unlock();
+			for (EntryBatch const &group : ready) {
+				deliver(group);
+			}
+			ready.clear();
+			lock.lock();
+			continue;
+		}
+
+		if (!run) {
+			break;
+		}
+
+		wake.wait_until(lock, nextFlush);
+	}
+}
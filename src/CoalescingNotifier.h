@@ -0,0 +1,68 @@
+/**
+ * CoalescingNotifier
+ *
+ * Sits in front of another notifier and folds entries that expire close
+ * together into a single notification, so a switch failing doesn't turn
+ * into hundreds of separate pages.
+ *
+ * The first entry in a group opens a window, and everything that joins
+ * the group before the window closes is delivered with it.  Entries can
+ * all go in one group, or be grouped by key prefix (everything before the
+ * last dot) or by the /24 or /64 they were last received from.  A group
+ * smaller than the minimum is passed on as individual notifications.
+ */
+class CoalescingNotifier : public Notifier {
+public:
+	enum GroupBy {
+		GROUP_ALL,
+		GROUP_PREFIX,
+		GROUP_SUBNET
+	};
+
+	CoalescingNotifier(NotifierRef target,
+		int window, GroupBy groupBy, int minimum);
+	virtual ~CoalescingNotifier();
+
+	// This starts and stops the target notifier as well
+	virtual bool start();
+	virtual void stop();
+
+	virtual void notify(EntryRef entry);
+	virtual void notifyBatch(EntryBatch const &batch);
+
+	// The window is in milliseconds
+	static std::shared_ptr<CoalescingNotifier> Create(NotifierRef target,
+		int window, GroupBy groupBy, int minimum)
+	{
+		return std::make_shared<CoalescingNotifier>(
+			target, window, groupBy, minimum);
+	}
+
+	// Parse "prefix" or "subnet" from the command line
+	static bool ParseGroupBy(char const *text, GroupBy *groupBy);
+
+private:
+	struct Group {
+		EntryBatch entries;
+		std::chrono::steady_clock::time_point flushAt;
+	};
+
+	NotifierRef target;
+	int window;
+	GroupBy groupBy;
+	int minimum;
+
+	// Open groups by group key, protected by mutex
+	std::map<std::string, Group> groups;
+	std::mutex mutex;
+	std::condition_variable wake;
+
+	volatile bool run;
+	std::thread *thread;
+
+	void loop();
+	void groupKey(EntryRef const &entry, std::string& key);
+	void deliver(EntryBatch const &group);
+};
+
+typedef std::shared_ptr<CoalescingNotifier> CoalescingNotifierRef;
@@ -1,74 +1,35 @@
 #include "system.h"
 
 #include "Entry.h"
-#include "Log.h"
-
-std::string Entry::notifyScript= SCRIPTDIR "/timeoutd-notify";
 
 Entry::Entry(char const *key, struct timeval & expires, char const *address)
 {
 	this->key= key;
 	this->expires= expires;
+	this->deadline= expires;
 	this->lastAddress= address;
+	this->lease= NULL;
+	this->route= NULL;
 }
 
 Entry::~Entry()
 {
 }
 
-void Entry::notify()
+void Entry::attach(EntryRef entry)
 {
-	Log::log(LOG_INFO,
-		"Timeout for %s (%s)",
-		key.c_str(), lastAddress.c_str());
-
-	char const *childArgv[4];
-	childArgv[0]= notifyScript.c_str();
-	childArgv[1]= key.c_str();
-	childArgv[2]= lastAddress.c_str();
-	childArgv[3]= NULL;
-
-	pid_t childPid= fork();
-	if (childPid == -1) {
-		Log::log(LOG_ERROR,
-			"Failed to fork for notification: %s",
-			strerror(errno));
-	} else if (childPid == 0) {
-		// This is the child
+	assert(entry->lease == NULL);
 
-		execv(childArgv[0], (char **)childArgv);
-
-		Log::log(LOG_ERROR, "Failed to launch notify script %s: %s",
-			childArgv[0], strerror(errno));
+	entry->lease= this;
+	entry->leaseLink= attached.insert(attached.end(), entry);
+}
 
-		_exit(99);
-	} else {
-		for (bool wait= true; wait; ) {
-			wait=false;
+void Entry::detach(EntryRef entry)
+{
+	assert(entry->lease == this);
 
-			int status;
-			pid_t waitRval= waitpid(childPid, &status, 0);
-			if (waitRval == -1) {
-				if (errno == EINTR) {
-					wait= true;
-				} else {
-					Log::log(LOG_ERROR,
-						"Error waiting for notification script: %s",
-						strerror(errno));
-				}
-			} else if (WIFEXITED(status)) {
-				if (WEXITSTATUS(status) != 0) {
-					Log::log(LOG_WARNING,
-						"Notification script exited with status %d",
-						WEXITSTATUS(status));
-				}
-			} else if (WIFSIGNALED(status)) {
-				Log::log(LOG_WARNING,
-					"Notification script exited on signal %d",
-					WTERMSIG(status));
-			}
-		}
-	}
+	attached.erase(entry->leaseLink);
+	entry->lease= NULL;
 }
 
 bool Entry::CompareTimeout(
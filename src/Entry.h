@@ -1,3 +1,5 @@
+class Route;
+
 /**
  * Entry
  *
@@ -5,8 +7,20 @@
  * the expire time as an absolute timeval, and the last IP an update was
  * received from.
  *
- * The entry implements notification as well.
+ * There are actually two expire times.  The deadline is when the entry
+ * really expires, and is updated by every keepalive.  The expires time is
+ * where the entry sits in the scheduler's timeout index, and can only be
+ * changed while the entry is off the index.  With lazy rescheduling the
+ * deadline runs ahead of the index, and the scheduler catches the index up
+ * when it reaches the entry.
+ *
+ * An entry can also be a lease, which is named like a key but with a
+ * leading '@'.  Entries attached to a lease aren't in the scheduler's
+ * timeout index themselves - the lease is, and when it expires all of the
+ * entries attached to it are notified.
  *
+ * The route that the entry's notifications go to is picked when the entry
+ * is created and kept here.
  */
 class Entry {
 public:
@@ -19,29 +33,76 @@ public:
 	struct timeval *getExpires() {
 		return &expires;
 	}
+	struct timeval *getDeadline() {
+		return &deadline;
+	}
+	char const *getLastAddress() {
+		return lastAddress.c_str();
+	}
 
-	void receive(struct timeval& expires, char const *address) {
-		this->expires= expires;
-		this->lastAddress= address;
+	void receive(struct timeval& deadline, char const *address) {
+		this->deadline= deadline;
+		if (lastAddress != address) {
+			lastAddress= address;
+		}
 	}
 
-	static bool CompareTimeout(
-		const std::shared_ptr<Entry>,
-		const std::shared_ptr<Entry>);
+	// Move the index position to the deadline.  Only call this while the
+	// entry is off the timeout index.
+	void reschedule() {
+		expires= deadline;
+	}
 
-	void notify();
+	// True if the deadline has moved past the index position
+	bool isStale() {
+		return timercmp(&deadline, &expires, >);
+	}
 
-	static void setNotifyScript(char const *file) {
-		notifyScript= file;
+	bool isLease() {
+		return key[0] == '@';
 	}
 
-private:
-	static std::string notifyScript;
+	// The lease this entry is attached to, or NULL
+	Entry *getLease() {
+		return lease;
+	}
 
+	Route *getRoute() {
+		return route;
+	}
+	void setRoute(Route *route) {
+		this->route= route;
+	}
+
+	// Called on a lease to attach or detach an entry
+	void attach(std::shared_ptr<Entry> entry);
+	void detach(std::shared_ptr<Entry> entry);
+
+	std::list<std::shared_ptr<Entry>>& getAttached() {
+		return attached;
+	}
+
+	static bool CompareTimeout(
+		const std::shared_ptr<Entry>,
+		const std::shared_ptr<Entry>);
+
+private:
 	std::string key;
 	struct timeval expires;
+	struct timeval deadline;
 
 	std::string lastAddress;
+
+	// Raw pointer so attached entries don't hold their lease in memory.
+	// The scheduler detaches everything before a lease is dropped.
+	Entry *lease;
+	std::list<std::shared_ptr<Entry>>::iterator leaseLink;
+
+	std::list<std::shared_ptr<Entry>> attached;
+
+	// Raw pointer since the route belongs to the router, which is only
+	// dropped after the scheduler has stopped.
+	Route *route;
 };
 
 typedef std::shared_ptr<Entry> EntryRef;
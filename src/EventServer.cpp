@@ -0,0 +1,399 @@
+#include "system.h"
+
+#include "Log.h"
+#include "Entry.h"
+#include "Notifier.h"
+#include "EventServer.h"
+
+// Most output we'll hold for one client before dropping events
+#define MAX_BUFFER (256 * 1024)
+
+// Longest command line a client can send
+#define MAX_COMMAND 4096
+
+#define MAX_SUBSCRIBERS 64
+
+#define MAX_EVENTS 16
+
+char const * const EventServer::EXPIRE= "EXPIRE";
+char const * const EventServer::REMOVE= "REMOVE";
+
+EventServer::EventServer(char const *path)
+{
+	this->path= path;
+
+	listenFd= -1;
+	epollFd= -1;
+	wakeFd= -1;
+
+	run= false;
+	thread= NULL;
+}
+
+EventServer::~EventServer()
+{
+}
+
+bool EventServer::start()
+{
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family= AF_UNIX;
+
+	if (path.size() >= sizeof(addr.sun_path)) {
+		Log::log(LOG_ERROR, "Event socket path %s is too long", path.c_str());
+		return false;
+	}
+	strcpy(addr.sun_path, path.c_str());
+
+	listenFd= socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (listenFd == -1) {
+		Log::log(LOG_ERROR, "Unable to create event socket: %s",
+			strerror(errno));
+		return false;
+	}
+
+	// A socket left over from a previous run would make bind fail
+	unlink(path.c_str());
+
+	if ((bind(listenFd, (struct sockaddr *)&addr, sizeof(addr)) == -1) ||
+		(listen(listenFd, 16) == -1))
+	{
+		Log::log(LOG_ERROR, "Unable to listen on event socket %s: %s",
+			path.c_str(), strerror(errno));
+		close(listenFd);
+		return false;
+	}
+
+	epollFd= epoll_create1(EPOLL_CLOEXEC);
+	wakeFd= eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if ((epollFd == -1) || (wakeFd == -1)) {
+		Log::log(LOG_ERROR, "Unable to set up event server: %s",
+			strerror(errno));
+		return false;
+	}
+
+	struct epoll_event event;
+	event.events= EPOLLIN;
+	event.data.fd= listenFd;
+	epoll_ctl(epollFd, EPOLL_CTL_ADD, listenFd, &event);
+
+	event.data.fd= wakeFd;
+	epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event);
+
+	run= true;
+	thread= new std::thread(&EventServer::loop, this);
+
+	Log::log(LOG_DEBUG, "Publishing events on %s", path.c_str());
+	return true;
+}
+
+void EventServer::stop()
+{
+	run= false;
+
+	uint64_t one= 1;
+	if (write(wakeFd, &one, sizeof(one)) == -1) {
+		Log::log(LOG_ERROR, "Error waking event server: %s",
+			strerror(errno));
+	}
+
+	thread->join();
+	delete thread;
+	thread= NULL;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		while (!subscribers.empty()) {
+			drop(subscribers.begin()->first);
+		}
+	}
+
+	close(listenFd);
+	unlink(path.c_str());
+
+	close(wakeFd);
+	close(epollFd);
+}
+
+bool EventServer::matches(Subscriber const &subscriber, char const *key)
+{
+	if (subscriber.everything) {
+		return true;
+	}
+	for (std::string const &prefix : subscriber.prefixes) {
+		if (strncmp(key, prefix.c_str(), prefix.size()) == 0) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void EventServer::publish(char const *type, EntryRef entry)
+{
+	publish(type, EntryBatch(1, entry));
+}
+
+void EventServer::publish(char const *type, EntryBatch const &batch)
+{
+	bool wake= false;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (subscribers.empty()) {
+			return;
+		}
+
+		std::string line;
+		for (EntryRef const &entry : batch) {
+			line= type;
+			line.append(" ");
+			line.append(entry->getKey());
+			line.append(" ");
+			line.append(entry->getLastAddress());
+			line.append("\n");
+
+			for (auto &fdSubscriber : subscribers) {
+				Subscriber& subscriber= fdSubscriber.second;
+				if (!matches(subscriber, entry->getKey())) {
+					continue;
+				}
+
+				// A buffer that was empty isn't being flushed, so the
+				// server thread has to be woken for it
+				bool wasEmpty= subscriber.output.empty();
+
+				// Let the client know what it missed before anything new
+				if (subscriber.dropped > 0) {
+					std::string notice= "DROPPED " +
+						std::to_string(subscriber.dropped) + "\n";
+
+					if (subscriber.output.size() + notice.size() +
+						line.size() <= MAX_BUFFER)
+					{
+						subscriber.output.append(notice);
+						subscriber.dropped= 0;
+					}
+				}
+
+				if ((subscriber.dropped == 0) &&
+					(subscriber.output.size() + line.size() <= MAX_BUFFER))
+				{
+					if (wasEmpty) {
+						wake= true;
+					}
+					subscriber.output.append(line);
+				} else {
+					subscriber.dropped++;
+					subscriber.droppedTotal++;
+				}
+			}
+		}
+	}
+
+	if (wake) {
+		uint64_t one= 1;
+		if (write(wakeFd, &one, sizeof(one)) == -1) {
+			// Non-blocking, so the counter is just already high
+		}
+	}
+}
+
+void EventServer::accept()
+{
+	for (;;) {
+		int fd= accept4(listenFd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd == -1) {
+			if ((errno != EAGAIN) && (errno != EINTR)) {
+				Log::log(LOG_ERROR, "Error accepting event client: %s",
+					strerror(errno));
+			}
+			return;
+		}
+
+		if (subscribers.size() >= MAX_SUBSCRIBERS) {
+			Log::log(LOG_WARNING,
+				"Refusing event client - already have %d",
+				MAX_SUBSCRIBERS);
+			close(fd);
+			continue;
+		}
+
+		struct epoll_event event;
+		event.events= EPOLLIN;
+		event.data.fd= fd;
+		epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &event);
+
+		Subscriber& subscriber= subscribers[fd];
+		subscriber.fd= fd;
+		subscriber.everything= false;
+		subscriber.dropped= 0;
+		subscriber.droppedTotal= 0;
+		subscriber.waitingToWrite= false;
+
+		Log::log(LOG_DEBUG, "Event client connected");
+	}
+}
+
+void EventServer::drop(int fd)
+{
+	auto subscriberIter= subscribers.find(fd);
+	if (subscriberIter == subscribers.end()) {
+		return;
+	}
+
+	if (subscriberIter->second.droppedTotal > 0) {
+		Log::log(LOG_WARNING,
+			"Event client fell behind and missed %lu events",
+			subscriberIter->second.droppedTotal);
+	}
+
+	epoll_ctl(epollFd, EPOLL_CTL_DEL, fd, NULL);
+	close(fd);
+	subscribers.erase(subscriberIter);
+
+	Log::log(LOG_DEBUG, "Event client disconnected");
+}
+
+void EventServer::read(Subscriber& subscriber)
+{
+	char buffer[1024];
+
+	for (;;) {
+		ssize_t readRval= recv(subscriber.fd, buffer, sizeof(buffer), 0);
+		if (readRval > 0) {
+			subscriber.input.append(buffer, readRval);
+			continue;
+		}
+		if ((readRval == -1) && (errno == EINTR)) {
+			continue;
+		}
+		if ((readRval == -1) && (errno == EAGAIN)) {
+			break;
+		}
+
+		// Closed or broken
+		drop(subscriber.fd);
+		return;
+	}
+
+	size_t end;
+	while ((end= subscriber.input.find('\n')) != std::string::npos) {
+		std::string command= subscriber.input.substr(0, end);
+		subscriber.input.erase(0, end + 1);
+
+		if (!command.empty() && (command.back() == '\r')) {
+			command.pop_back();
+		}
+
+		if (command == "SUBSCRIBE") {
+			subscriber.everything= true;
+			subscriber.output.append("OK\n");
+		} else if (command.compare(0, 10, "SUBSCRIBE ") == 0) {
+			subscriber.prefixes.push_back(command.substr(10));
+			subscriber.output.append("OK\n");
+		} else {
+			subscriber.output.append("ERROR unknown command\n");
+		}
+	}
+
+	if (subscriber.input.size() > MAX_COMMAND) {
+		Log::log(LOG_WARNING, "Event client sent an overlong command");
+		drop(subscriber.fd);
+		return;
+	}
+
+	flush(subscriber);
+}
+
+void EventServer::flush(Subscriber& subscriber)
+{
+	while (!subscriber.output.empty()) {
+		ssize_t sendRval= send(subscriber.fd,
+			subscriber.output.data(), subscriber.output.size(),
+			MSG_DONTWAIT | MSG_NOSIGNAL);
+
+		if (sendRval > 0) {
+			subscriber.output.erase(0, sendRval);
+		} else if ((sendRval == -1) && (errno == EINTR)) {
+			continue;
+		} else if ((sendRval == -1) && (errno == EAGAIN)) {
+			break;
+		} else {
+			drop(subscriber.fd);
+			return;
+		}
+	}
+
+	// Only ask to hear about room in the socket while we have something
+	// waiting for it.
+	bool waitingToWrite= !subscriber.output.empty();
+	if (waitingToWrite != subscriber.waitingToWrite) {
+		struct epoll_event event;
+		event.events= waitingToWrite ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+		event.data.fd= subscriber.fd;
+		epoll_ctl(epollFd, EPOLL_CTL_MOD, subscriber.fd, &event);
+
+		subscriber.waitingToWrite= waitingToWrite;
+	}
+}
+
+void EventServer::loop()
+{
+	while (run) {
+		struct epoll_event events[MAX_EVENTS];
+		int eventCount= epoll_wait(epollFd, events, MAX_EVENTS, -1);
+
+		if (eventCount == -1) {
+			if (errno != EINTR) {
+				Log::log(LOG_ERROR, "Error waiting for event clients: %s",
+					strerror(errno));
+				sleep(1);
+			}
+			continue;
+		}
+
+		std::lock_guard<std::mutex> lock(mutex);
+
+		for (int i= 0; i < eventCount; i++) {
+			int fd= events[i].data.fd;
+
+			if (fd == wakeFd) {
+				uint64_t junk;
+				if (::read(wakeFd, &junk, sizeof(junk)) == -1) {
+					// Non-blocking, so this is just a spurious wake
+				}
+
+				// Collect first since a failed write drops the client
+				std::list<int> pending;
+				for (auto const &fdSubscriber : subscribers) {
+					if (!fdSubscriber.second.output.empty() &&
+						!fdSubscriber.second.waitingToWrite)
+					{
+						pending.push_back(fdSubscriber.first);
+					}
+				}
+				for (int pendingFd : pending) {
+					auto subscriberIter= subscribers.find(pendingFd);
+					if (subscriberIter != subscribers.end()) {
+						flush(subscriberIter->second);
+					}
+				}
+			} else if (fd == listenFd) {
+				accept();
+			} else {
+				auto subscriberIter= subscribers.find(fd);
+				if (subscriberIter == subscribers.end()) {
+					continue;
+				}
+
+				if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+					drop(fd);
+				} else if (events[i].events & EPOLLIN) {
+					read(subscriberIter->second);
+				} else if (events[i].events & EPOLLOUT) {
+					flush(subscriberIter->second);
+				}
+			}
+		}
+	}
+}
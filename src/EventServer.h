@@ -0,0 +1,80 @@
+/**
+ * EventServer
+ *
+ * A Unix domain socket that local programs can connect to for a stream of
+ * timeouts and voluntary removals as they happen, instead of having
+ * timeoutd run something for them.
+ *
+ * A client sends "SUBSCRIBE" to get everything, or "SUBSCRIBE prefix" for
+ * keys that start with the prefix, and can subscribe to several prefixes.
+ * After that it gets lines like:
+ *
+ *     EXPIRE key address
+ *     REMOVE key address
+ *
+ * Each client has a bounded output buffer.  If a client doesn't keep up,
+ * events for it are dropped and counted rather than held, and once there
+ * is room again it gets a "DROPPED count" line.  Publishing never blocks,
+ * so a slow client can't hold up the scheduler.
+ */
+class EventServer {
+public:
+	EventServer(char const *path);
+	virtual ~EventServer();
+
+	bool start();
+	void stop();
+
+	// Event types
+	static char const * const EXPIRE;
+	static char const * const REMOVE;
+
+	void publish(char const *type, EntryBatch const &batch);
+	void publish(char const *type, EntryRef entry);
+
+	static std::shared_ptr<EventServer> Create(char const *path) {
+		return std::make_shared<EventServer>(path);
+	}
+
+private:
+	struct Subscriber {
+		int fd;
+
+		// Empty until the client subscribes
+		std::list<std::string> prefixes;
+		bool everything;
+
+		std::string input;
+		std::string output;
+
+		// Events dropped since the last DROPPED line, and in total
+		unsigned long dropped;
+		unsigned long droppedTotal;
+
+		bool waitingToWrite;
+	};
+
+	std::string path;
+
+	int listenFd;
+	int epollFd;
+
+	// Written to get the server thread to flush output, or to stop
+	int wakeFd;
+
+	// Subscribers by descriptor, protected by mutex
+	std::map<int, Subscriber> subscribers;
+	std::mutex mutex;
+
+	volatile bool run;
+	std::thread *thread;
+
+	void loop();
+	void accept();
+	void read(Subscriber& subscriber);
+	void flush(Subscriber& subscriber);
+	void drop(int fd);
+	bool matches(Subscriber const &subscriber, char const *key);
+};
+
+typedef std::shared_ptr<EventServer> EventServerRef;
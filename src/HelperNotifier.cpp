@@ -0,0 +1,360 @@
+#include "system.h"
+
+#include "Log.h"
+#include "Entry.h"
+#include "Notifier.h"
+#include "ScriptNotifier.h"
+#include "HelperNotifier.h"
+
+// Most lines we'll hold for the helper, for example while it restarts
+#define MAX_QUEUED 100000
+
+// Roughly how much to hand to write() at once
+#define MAX_CHUNK 65536
+
+// Don't restart a helper that keeps dying more often than this
+#define RESTART_DELAY_MS 1000
+
+// How long to wait for the helper to finish up at shutdown
+#define STOP_TIMEOUT 5
+
+static void monotonicNow(struct timespec *now)
+{
+	clock_gettime(CLOCK_MONOTONIC, now);
+}
+
+static void logExit(char const *helper, int status)
+{
+	if (WIFEXITED(status)) {
+		Log::log(LOG_WARNING,
+			"Notification helper %s exited with status %d",
+			helper, WEXITSTATUS(status));
+	} else if (WIFSIGNALED(status)) {
+		Log::log(LOG_WARNING,
+			"Notification helper %s exited on signal %d",
+			helper, WTERMSIG(status));
+	}
+}
+
+HelperNotifier::HelperNotifier(char const *helper)
+{
+	this->helper= helper;
+
+	run= false;
+	thread= NULL;
+
+	pid= -1;
+	pipeFd= -1;
+	lastStart.tv_sec= 0;
+	lastStart.tv_nsec= 0;
+}
+
+HelperNotifier::~HelperNotifier()
+{
+}
+
+bool HelperNotifier::start()
+{
+	// Start the first helper here so a bad path is caught at startup
+	if (!startHelper()) {
+		return false;
+	}
+
+	run= true;
+	thread= new std::thread(&HelperNotifier::loop, this);
+
+	return true;
+}
+
+void HelperNotifier::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		run= false;
+	}
+	wake.notify_all();
+
+	thread->join();
+	delete thread;
+	thread= NULL;
+}
+
+void HelperNotifier::notify(EntryRef entry)
+{
+	notifyGroup(EntryBatch(1, entry));
+}
+
+void HelperNotifier::notifyGroup(EntryBatch const &group)
+{
+	std::string line;
+	for (EntryRef const &entry : group) {
+		if (!line.empty()) {
+			line.append(" ");
+		}
+		line.append(entry->getKey());
+		line.append(" ");
+		line.append(entry->getLastAddress());
+	}
+	line.append("\n");
+
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (queue.size() >= MAX_QUEUED) {
+			Log::log(LOG_ERROR,
+				"Notification queue is full - dropping notification for %s",
+				ScriptNotifier::Describe(group).c_str());
+			return;
+		}
+		queue.push_back(line);
+	}
+	wake.notify_one();
+}
+
+bool HelperNotifier::startHelper()
+{
+	monotonicNow(&lastStart);
+
+	int fds[2];
+	if (pipe2(fds, O_CLOEXEC) == -1) {
+		Log::log(LOG_ERROR,
+			"Unable to create pipe for notification helper: %s",
+			strerror(errno));
+		return false;
+	}
+
+	char const *childArgv[2];
+	childArgv[0]= helper.c_str();
+	childArgv[1]= NULL;
+
+	int spawnRval= ScriptNotifier::Spawn(childArgv, &pid, fds[0]);
+	close(fds[0]);
+
+	if (spawnRval != 0) {
+		Log::log(LOG_ERROR, "Failed to launch notification helper %s: %s",
+			childArgv[0], strerror(spawnRval));
+		close(fds[1]);
+		pid= -1;
+		return false;
+	}
+
+	// Writes poll so that a helper which stops reading can't wedge
+	// shutdown.
+	pipeFd= fds[1];
+	fcntl(pipeFd, F_SETFL, fcntl(pipeFd, F_GETFL) | O_NONBLOCK);
+
+	Log::log(LOG_INFO, "Started notification helper %s (pid %d)",
+		childArgv[0], (int)pid);
+
+	return true;
+}
+
+void HelperNotifier::stopHelper(bool force)
+{
+	if (pid == -1) {
+		return;
+	}
+
+	// Closing the pipe gives the helper EOF, which should be its cue to
+	// finish up and exit.
+	close(pipeFd);
+	pipeFd= -1;
+
+	int status;
+	pid_t waitRval= 0;
+
+	if (!force) {
+		for (int i= 0; (i < STOP_TIMEOUT * 10) && (waitRval == 0); i++) {
+			waitRval= waitpid(pid, &status, WNOHANG);
+			if (waitRval == 0) {
+				usleep(100000);
+			}
+		}
+		if (waitRval == 0) {
+			Log::log(LOG_WARNING,
+				"Notification helper %s didn't exit after %d seconds",
+				helper.c_str(), STOP_TIMEOUT);
+		}
+	}
+
+	if (waitRval == 0) {
+		kill(-pid, SIGKILL);
+		do {
+			waitRval= waitpid(pid, &status, 0);
+		} while ((waitRval == -1) && (errno == EINTR));
+	}
+
+	if (waitRval > 0) {
+		if (force || !WIFEXITED(status) || (WEXITSTATUS(status) != 0)) {
+			logExit(helper.c_str(), status);
+		}
+	}
+
+	pid= -1;
+}
+
+bool HelperNotifier::checkHelper()
+{
+	if (pid == -1) {
+		return false;
+	}
+
+	int status;
+	pid_t waitRval;
+	do {
+		waitRval= waitpid(pid, &status, WNOHANG);
+	} while ((waitRval == -1) && (errno == EINTR));
+
+	if (waitRval == 0) {
+		return true;
+	}
+
+	if (waitRval == -1) {
+		// Without a status there's no telling whether it's still running,
+		// so leave it be.  If it has gone, writes to the pipe will fail.
+		Log::log(LOG_ERROR,
+			"Error waiting for notification helper %s: %s",
+			helper.c_str(), strerror(errno));
+		return true;
+	}
+
+	logExit(helper.c_str(), status);
+
+	close(pipeFd);
+	pipeFd= -1;
+	pid= -1;
+
+	return false;
+}
+
+bool HelperNotifier::writeChunk(std::string const &chunk, size_t *written)
+{
+	*written= 0;
+	int stalls= 0;
+
+	while (*written < chunk.size()) {
+		ssize_t writeRval= write(pipeFd,
+			chunk.data() + *written, chunk.size() - *written);
+
+		if (writeRval > 0) {
+			*written+= writeRval;
+			stalls= 0;
+		} else if ((writeRval == -1) && (errno == EINTR)) {
+			continue;
+		} else if ((writeRval == -1) && (errno == EAGAIN)) {
+			// The pipe is full, so the helper is busy.  If it has
+			// died instead the next write fails with EPIPE.
+			struct pollfd pollFd;
+			pollFd.fd= pipeFd;
+			pollFd.events= POLLOUT;
+			pollFd.revents= 0;
+
+			if (poll(&pollFd, 1, 1000) == 0) {
+				if (!checkHelper()) {
+					return false;
+				}
+				if (!run && (++stalls >= STOP_TIMEOUT)) {
+					Log::log(LOG_WARNING,
+						"Notification helper %s stopped reading",
+						helper.c_str());
+					return false;
+				}
+			}
+		} else {
+			Log::log(LOG_ERROR,
+				"Error writing to notification helper: %s",
+				strerror(errno));
+			return false;
+		}
+	}
+
+	return true;
+}
+
+int HelperNotifier::restartWait()
+{
+	struct timespec now;
+	monotonicNow(&now);
+
+	long elapsedMs= (now.tv_sec - lastStart.tv_sec) * 1000L +
+		(now.tv_nsec - lastStart.tv_nsec) / 1000000L;
+
+	return (elapsedMs >= RESTART_DELAY_MS) ?
+		0 : (int)(RESTART_DELAY_MS - elapsedMs);
+}
+
+void HelperNotifier::loop()
+{
+	for (;;) {
+		bool localRun;
+		std::string chunk;
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+
+			// Wake now and then even with nothing to do, to notice if
+			// the helper has died.
+			if (run) {
+				if (queue.empty()) {
+					wake.wait_for(lock, std::chrono::seconds(1));
+				} else if ((pid == -1) && (restartWait() > 0)) {
+					wake.wait_for(lock,
+						std::chrono::milliseconds(restartWait()));
+				}
+			}
+			localRun= run;
+
+			// Lines stay queued until they've been written
+			for (std::string const &line : queue) {
+				if (chunk.size() >= MAX_CHUNK) {
+					break;
+				}
+				chunk.append(line);
+			}
+		}
+
+		checkHelper();
+
+		if (chunk.empty()) {
+			if (!localRun) {
+				break;
+			}
+			continue;
+		}
+
+		// A helper that has died is restarted when there's something
+		// for it to do.
+		if (pid == -1) {
+			if (!localRun) {
+				std::lock_guard<std::mutex> lock(mutex);
+				Log::log(LOG_WARNING,
+					"Discarding %d queued notifications at shutdown",
+					(int)queue.size());
+				queue.clear();
+				break;
+			}
+
+			if ((restartWait() > 0) || !startHelper()) {
+				continue;
+			}
+		}
+
+		size_t written;
+		bool writeRval= writeChunk(chunk, &written);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			size_t done= 0;
+			while (!queue.empty() &&
+				(done + queue.front().size() <= written))
+			{
+				done+= queue.front().size();
+				queue.pop_front();
+			}
+		}
+
+		if (!writeRval) {
+			stopHelper(true);
+		}
+	}
+
+	stopHelper(false);
+}
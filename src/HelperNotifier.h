@@ -0,0 +1,59 @@
+/**
+ * HelperNotifier
+ *
+ * Notifies by streaming expired entries to a long-running helper program
+ * instead of launching a script for each one.  The helper is started once
+ * and reads one line per notification on its standard input:
+ *
+ *     key address\n
+ *
+ * Neither field can contain a space, so the line can be split on spaces.
+ * A coalesced group is a single line with the key and address of each
+ * entry in turn.
+ *
+ * A writer thread feeds the helper.  If the helper dies it's restarted, at
+ * most once a second, and notifications are held in a bounded queue in
+ * the meantime.  A line is only removed from the queue
+ * once it has been completely written, so a line that was cut short by
+ * the helper dying is sent again to the new helper.
+ */
+class HelperNotifier : public Notifier {
+public:
+	HelperNotifier(char const *helper);
+	virtual ~HelperNotifier();
+
+	virtual bool start();
+	virtual void stop();
+
+	virtual void notify(EntryRef entry);
+	virtual void notifyGroup(EntryBatch const &group);
+
+	static std::shared_ptr<HelperNotifier> Create(char const *helper) {
+		return std::make_shared<HelperNotifier>(helper);
+	}
+
+private:
+	std::string helper;
+
+	// Lines waiting to be written, protected by mutex
+	std::list<std::string> queue;
+	std::mutex mutex;
+	std::condition_variable wake;
+
+	volatile bool run;
+	std::thread *thread;
+
+	// Only touched by the writer thread once it's running
+	pid_t pid;
+	int pipeFd;
+	struct timespec lastStart;
+
+	void loop();
+	bool startHelper();
+	void stopHelper(bool force);
+	bool checkHelper();
+	bool writeChunk(std::string const &chunk, size_t *written);
+	int restartWait();
+};
+
+typedef std::shared_ptr<HelperNotifier> HelperNotifierRef;
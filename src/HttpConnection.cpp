@@ -0,0 +1,349 @@
+#include "system.h"
+
+#include "Log.h"
+#include "HttpConnection.h"
+
+// Longest status or header line we'll accept
+#define MAX_LINE 8192
+
+HttpConnection::HttpConnection(
+	char const *host, int port, SSL_CTX *sslCtx, int timeout)
+{
+	this->host= host;
+	this->port= port;
+	this->sslCtx= sslCtx;
+	this->timeout= timeout;
+
+	fd= -1;
+	ssl= NULL;
+}
+
+HttpConnection::~HttpConnection()
+{
+	close();
+}
+
+bool HttpConnection::open()
+{
+	char portText[16];
+	snprintf(portText, sizeof(portText), "%d", port);
+
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_flags= AI_ADDRCONFIG;
+	hints.ai_family= AF_UNSPEC;
+	hints.ai_socktype= SOCK_STREAM;
+
+	struct addrinfo *hostInfo;
+	int lookupRval= getaddrinfo(host.c_str(), portText, &hints, &hostInfo);
+	if (lookupRval != 0) {
+		Log::log(LOG_ERROR, "Unable to look up %s: %s",
+			host.c_str(), gai_strerror(lookupRval));
+		return false;
+	}
+
+	int lastErrno= 0;
+	for (struct addrinfo *info= hostInfo;
+		(info != NULL) && (fd == -1); info= info->ai_next)
+	{
+		fd= socket(info->ai_family, info->ai_socktype | SOCK_CLOEXEC,
+			info->ai_protocol);
+		if (fd == -1) {
+			lastErrno= errno;
+			continue;
+		}
+
+		// On Linux the send timeout also covers connect()
+		if (timeout > 0) {
+			struct timeval tv;
+			tv.tv_sec= timeout;
+			tv.tv_usec= 0;
+			setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+			setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		}
+
+		int one= 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+		if (connect(fd, info->ai_addr, info->ai_addrlen) == -1) {
+			lastErrno= errno;
+			::close(fd);
+			fd= -1;
+		}
+	}
+	freeaddrinfo(hostInfo);
+
+	if (fd == -1) {
+		Log::log(LOG_ERROR, "Unable to connect to %s port %d: %s",
+			host.c_str(), port, strerror(lastErrno));
+		return false;
+	}
+
+	if (sslCtx != NULL) {
+		ssl= SSL_new(sslCtx);
+		if (ssl == NULL) {
+			Log::log(LOG_ERROR, "Unable to create TLS session");
+			close();
+			return false;
+		}
+
+		SSL_set_fd(ssl, fd);
+		SSL_set_tlsext_host_name(ssl, host.c_str());
+		X509_VERIFY_PARAM_set1_host(SSL_get0_param(ssl), host.c_str(), 0);
+
+		if (SSL_connect(ssl) != 1) {
+			char errorText[256];
+			ERR_error_string_n(ERR_get_error(), errorText, sizeof(errorText));
+
+			Log::log(LOG_ERROR, "TLS handshake with %s failed: %s",
+				host.c_str(), errorText);
+			close();
+			return false;
+		}
+	}
+
+	Log::log(LOG_DEBUG, "Connected to %s port %d", host.c_str(), port);
+	return true;
+}
+
+void HttpConnection::close()
+{
+	if (ssl != NULL) {
+		SSL_free(ssl);
+		ssl= NULL;
+	}
+	if (fd != -1) {
+		::close(fd);
+		fd= -1;
+	}
+	readBuffer.clear();
+}
+
+bool HttpConnection::writeAll(char const *data, size_t length)
+{
+	while (length > 0) {
+		ssize_t writeRval;
+		if (ssl != NULL) {
+			writeRval= SSL_write(ssl, data, length);
+		} else {
+			writeRval= send(fd, data, length, MSG_NOSIGNAL);
+			if ((writeRval == -1) && (errno == EINTR)) {
+				continue;
+			}
+		}
+
+		if (writeRval <= 0) {
+			return false;
+		}
+		data+= writeRval;
+		length-= writeRval;
+	}
+	return true;
+}
+
+ssize_t HttpConnection::readSome(char *data, size_t length)
+{
+	if (ssl != NULL) {
+		int readRval= SSL_read(ssl, data, length);
+		if (readRval > 0) {
+			return readRval;
+		}
+		return (SSL_get_error(ssl, readRval) == SSL_ERROR_ZERO_RETURN) ?
+			0 : -1;
+	}
+
+	ssize_t readRval;
+	do {
+		readRval= recv(fd, data, length, 0);
+	} while ((readRval == -1) && (errno == EINTR));
+
+	return readRval;
+}
+
+bool HttpConnection::readLine(std::string& line)
+{
+	for (;;) {
+		size_t end= readBuffer.find("\r\n");
+		if (end != std::string::npos) {
+			line= readBuffer.substr(0, end);
+			readBuffer.erase(0, end + 2);
+			return true;
+		}
+
+		if (readBuffer.size() > MAX_LINE) {
+			return false;
+		}
+
+		char buffer[4096];
+		ssize_t readRval= readSome(buffer, sizeof(buffer));
+		if (readRval <= 0) {
+			return false;
+		}
+		readBuffer.append(buffer, readRval);
+	}
+}
+
+bool HttpConnection::readBytes(size_t length)
+{
+	size_t buffered= (length < readBuffer.size()) ?
+		length : readBuffer.size();
+
+	readBuffer.erase(0, buffered);
+	length-= buffered;
+
+	while (length > 0) {
+		char buffer[4096];
+		ssize_t readRval= readSome(buffer,
+			(length < sizeof(buffer)) ? length : sizeof(buffer));
+		if (readRval <= 0) {
+			return false;
+		}
+		length-= readRval;
+	}
+	return true;
+}
+
+bool HttpConnection::readResponse(int *status, bool *keepAlive)
+{
+	std::string line;
+	int minorVersion;
+	bool chunked;
+	bool haveLength;
+	size_t contentLength;
+
+	// Skip any informational responses
+	do {
+		if (!readLine(line) ||
+			(sscanf(line.c_str(), "HTTP/1.%d %d", &minorVersion, status) != 2))
+		{
+			return false;
+		}
+
+		*keepAlive= (minorVersion >= 1);
+		chunked= false;
+		haveLength= false;
+		contentLength= 0;
+
+		for (;;) {
+			if (!readLine(line)) {
+				return false;
+			}
+			if (line.empty()) {
+				break;
+			}
+
+			char const *header= line.c_str();
+			char const *value= strchr(header, ':');
+			if (value == NULL) {
+				continue;
+			}
+			for (value++; (*value == ' ') || (*value == '\t'); value++) {
+			}
+
+			if (strncasecmp(header, "Content-Length:", 15) == 0) {
+				contentLength= strtoul(value, NULL, 10);
+				haveLength= true;
+			} else if (strncasecmp(header, "Transfer-Encoding:", 18) == 0) {
+				chunked= (strcasestr(value, "chunked") != NULL);
+			} else if (strncasecmp(header, "Connection:", 11) == 0) {
+				if (strcasestr(value, "close") != NULL) {
+					*keepAlive= false;
+				} else if (strcasestr(value, "keep-alive") != NULL) {
+					*keepAlive= true;
+				}
+			}
+		}
+	} while ((*status >= 100) && (*status < 200));
+
+	if ((*status == 204) || (*status == 304)) {
+		return true;
+	}
+
+	if (chunked) {
+		for (;;) {
+			if (!readLine(line)) {
+				return false;
+			}
+			size_t chunkLength= strtoul(line.c_str(), NULL, 16);
+			if (chunkLength == 0) {
+				break;
+			}
+			if (!readBytes(chunkLength) || !readLine(line)) {
+				return false;
+			}
+		}
+
+		// Trailers, if any
+		do {
+			if (!readLine(line)) {
+				return false;
+			}
+		} while (!line.empty());
+
+		return true;
+	}
+
+	if (haveLength) {
+		return readBytes(contentLength);
+	}
+
+	// No length, so the body runs until the server closes
+	*keepAlive= false;
+	char buffer[4096];
+	while (readSome(buffer, sizeof(buffer)) > 0) {
+	}
+	return true;
+}
+
+bool HttpConnection::post(char const *path, char const *contentType,
+	std::string const &body, int *status)
+{
+	std::string request= "POST ";
+	request.append(path);
+	request.append(" HTTP/1.1\r\nHost: ");
+
+	if (host.find(':') != std::string::npos) {
+		request.append("[" + host + "]");
+	} else {
+		request.append(host);
+	}
+	if (port != ((sslCtx != NULL) ? 443 : 80)) {
+		request.append(":" + std::to_string(port));
+	}
+
+	request.append("\r\nUser-Agent: " PACKAGE_NAME "/" PACKAGE_VERSION);
+	request.append("\r\nContent-Type: ");
+	request.append(contentType);
+	request.append("\r\nContent-Length: " + std::to_string(body.size()));
+	request.append("\r\n\r\n");
+	request.append(body);
+
+	// The server may have closed an idle connection since the last request,
+	// in which case one more try on a new connection is in order.  This
+	// can deliver the same request twice, which is fine for notifications.
+	for (int attempt= 0; attempt < 2; attempt++) {
+		bool reused= (fd != -1);
+		if (!reused && !open()) {
+			return false;
+		}
+
+		bool keepAlive;
+		if (writeAll(request.data(), request.size()) &&
+			readResponse(status, &keepAlive))
+		{
+			if (!keepAlive) {
+				close();
+			}
+			return true;
+		}
+
+		close();
+		if (!reused) {
+			Log::log(LOG_ERROR, "Request to %s port %d failed",
+				host.c_str(), port);
+			return false;
+		}
+	}
+
+	return false;
+}
@@ -0,0 +1,53 @@
+/**
+ * HttpConnection
+ *
+ * A minimal HTTP/1.1 client connection to a single server, optionally over
+ * TLS.  The connection is kept open between requests and reopened as
+ * needed, so a steady trickle of requests only pays for the TCP and TLS
+ * handshakes once.
+ *
+ * This only does what the webhook notifier needs: POST a body and return
+ * the status code.  The response body is read and thrown away.  An object
+ * is not thread-safe - each thread that makes requests should have its own.
+ */
+class HttpConnection {
+public:
+	// If sslCtx is NULL the connection is plain HTTP.  The timeout applies
+	// to connecting and to each read or write, and 0 means none.
+	HttpConnection(char const *host, int port, SSL_CTX *sslCtx, int timeout);
+	virtual ~HttpConnection();
+
+	// Send a POST and wait for the response.  Returns false if the request
+	// couldn't be completed, which includes any connection problem, and
+	// otherwise sets the response status.
+	bool post(char const *path, char const *contentType,
+		std::string const &body, int *status);
+
+	void close();
+
+private:
+	HttpConnection(HttpConnection const &);
+	HttpConnection& operator=(HttpConnection const &);
+
+	std::string host;
+	int port;
+	SSL_CTX *sslCtx;
+	int timeout;
+
+	int fd;
+	SSL *ssl;
+
+	// Bytes read past the end of the last thing parsed
+	std::string readBuffer;
+
+	bool open();
+
+	bool writeAll(char const *data, size_t length);
+	ssize_t readSome(char *data, size_t length);
+
+	bool readLine(std::string& line);
+	bool readBytes(size_t length);
+	bool readResponse(int *status, bool *keepAlive);
+};
+
+typedef std::shared_ptr<HttpConnection> HttpConnectionRef;
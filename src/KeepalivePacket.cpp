@@ -0,0 +1,186 @@
+#include "system.h"
+
+#include "KeepalivePacket.h"
+
+// The HMAC covers everything from the timestamp to the end of the packet
+#define HMAC_OFFSET (offsetof(struct keepalive_hdr, timestamp))
+
+KeepalivePacket::KeepalivePacket()
+{
+	length= 0;
+	payloadOffset= 0;
+	recordCount= 0;
+	sign= false;
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	hmacCtx= NULL;
+#else
+	HMAC_CTX_init(&localCtx);
+	hmacCtx= &localCtx;
+#endif
+}
+
+KeepalivePacket::~KeepalivePacket()
+{
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	if (hmacCtx != NULL) {
+		HMAC_CTX_free(hmacCtx);
+	}
+#else
+	HMAC_CTX_cleanup(&localCtx);
+#endif
+}
+
+bool KeepalivePacket::ValidKey(char const *key)
+{
+	if (*key == '\0') {
+		return false;
+	}
+	for (char const *c= key; *c != '\0'; c++) {
+		if (!isalnum(*c) && (*c != '.')) {
+			return false;
+		}
+	}
+	return true;
+}
+
+bool KeepalivePacket::setPreSharedKey(char const *preSharedKey)
+{
+	unsigned char hmacKey[KEEPALIVE_HMAC_SIZE];
+	memset(hmacKey, 0, KEEPALIVE_HMAC_SIZE);
+	size_t preSharedKeyLen= strlen(preSharedKey);
+	memcpy(hmacKey, preSharedKey,
+		(preSharedKeyLen > KEEPALIVE_HMAC_SIZE) ?
+		KEEPALIVE_HMAC_SIZE : preSharedKeyLen);
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	if (hmacCtx == NULL) {
+		hmacCtx= HMAC_CTX_new();
+		if (hmacCtx == NULL) {
+			return false;
+		}
+	}
+#endif
+
+	// This computes the inner and outer pads once, and later calls to
+	// HMAC_Init_ex with a NULL key just reset to that state.
+	if (!HMAC_Init_ex(hmacCtx,
+		hmacKey, KEEPALIVE_HMAC_SIZE, EVP_sha256(), NULL))
+	{
+		return false;
+	}
+
+	if (!sign) {
+		size_t headerSize= sizeof(struct keepalive_hdr);
+		size_t payloadLen= length - payloadOffset;
+
+		if (headerSize + payloadLen > KEEPALIVE_MAX_PACKET) {
+			return false;
+		}
+
+		memmove(buffer + headerSize, buffer + payloadOffset, payloadLen);
+		payloadOffset= headerSize;
+		length= headerSize + payloadLen;
+
+		struct keepalive_hdr *header=
+			reinterpret_cast<struct keepalive_hdr *>(buffer);
+
+		memset(header, 0, headerSize);
+		header->magic= htons(KEEPALIVE_HEADER_MAGIC);
+
+		sign= true;
+		setVersion();
+	}
+
+	return true;
+}
+
+void KeepalivePacket::setVersion()
+{
+	if (sign) {
+		// Stick with version 1 for a single record so older listeners
+		// can still read it.
+		struct keepalive_hdr *header=
+			reinterpret_cast<struct keepalive_hdr *>(buffer);
+
+		header->version= htons((recordCount > 1) ?
+			KEEPALIVE_HEADER_VERSION_MULTI : KEEPALIVE_HEADER_VERSION);
+	}
+}
+
+bool KeepalivePacket::setRecord(
+	char const *key, int timeout, char const *lease)
+{
+	clear();
+	return addRecord(key, timeout, lease);
+}
+
+void KeepalivePacket::clear()
+{
+	length= payloadOffset;
+	recordCount= 0;
+	setVersion();
+}
+
+bool KeepalivePacket::addRecord(
+	char const *key, int timeout, char const *lease)
+{
+	size_t room= KEEPALIVE_MAX_PACKET - length;
+	char *record= reinterpret_cast<char *>(buffer + length);
+	int recordLen;
+
+	if (lease == NULL) {
+		if (!ValidKey(key)) {
+			return false;
+		}
+
+		recordLen= snprintf(record, room,
+			(recordCount > 0) ? "\n%s:%d" : "%s:%d", key, timeout);
+	} else {
+		if (((*key != '\0') && !ValidKey(key)) || !ValidKey(lease)) {
+			return false;
+		}
+
+		recordLen= snprintf(record, room,
+			(recordCount > 0) ? "\n%s@%s:%d" : "%s@%s:%d",
+			key, lease, timeout);
+	}
+
+	if ((recordLen < 0) || ((size_t)recordLen >= room)) {
+		return false;
+	}
+
+	length+= recordLen;
+	recordCount++;
+	setVersion();
+
+	return true;
+}
+
+bool KeepalivePacket::refresh(time_t now)
+{
+	if (!sign) {
+		return true;
+	}
+
+	struct keepalive_hdr *header=
+		reinterpret_cast<struct keepalive_hdr *>(buffer);
+
+	header->timestamp= htonl(now);
+
+	unsigned int hmacLen= KEEPALIVE_HMAC_SIZE;
+	return HMAC_Init_ex(hmacCtx, NULL, 0, NULL, NULL) &&
+		HMAC_Update(hmacCtx, buffer + HMAC_OFFSET, length - HMAC_OFFSET) &&
+		HMAC_Final(hmacCtx, header->hmac, &hmacLen);
+}
+
+ssize_t KeepalivePacket::send(int sock, int flags)
+{
+	return ::send(sock, buffer, length, flags);
+}
+
+ssize_t KeepalivePacket::sendTo(int sock,
+	struct sockaddr const *addr, socklen_t addrLen, int flags)
+{
+	return ::sendto(sock, buffer, length, flags, addr, addrLen);
+}
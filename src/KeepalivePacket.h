@@ -0,0 +1,121 @@
+#ifndef TIMEOUTD_KEEPALIVEPACKET_H
+#define TIMEOUTD_KEEPALIVEPACKET_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#include <openssl/hmac.h>
+
+#include "protocol.h"
+
+/**
+ * KeepalivePacket
+ *
+ * A prebuilt keepalive datagram for either the simple or the signed
+ * protocol.  This is what the senders use to build their packets, and it's
+ * also built as a standalone library so applications can do their own
+ * heartbeating without running a sender thread.
+ *
+ * The packet lives in a fixed buffer inside the object.  Once the key is
+ * set, refresh() and send() don't allocate and don't block, so they're safe
+ * to call from an event loop.  For signed packets the HMAC key schedule is
+ * computed once in setPreSharedKey(), so a refresh only has to hash the
+ * timestamp and payload.
+ *
+ * Typical use:
+ *
+ *     KeepalivePacket packet;
+ *     packet.setPreSharedKey(psk);        // only for the signed protocol
+ *     packet.setRecord("node.web1", 10);
+ *
+ *     // ... then every couple of seconds
+ *     packet.refresh(time(NULL));
+ *     packet.send(sock);
+ *
+ * A packet can also carry several records, for example to send a whole
+ * host's worth of keys at once: call clear() and then addRecord() until it
+ * returns false.  Packets with more than one record use the multi-record
+ * format, which older listeners don't understand.
+ *
+ * An object is not thread-safe, but separate objects don't share anything.
+ */
+class KeepalivePacket {
+public:
+	KeepalivePacket();
+	virtual ~KeepalivePacket();
+
+	// Switch to the signed protocol using the given pre-shared key.  This
+	// can be called before or after setRecord().
+	bool setPreSharedKey(char const *preSharedKey);
+
+	// Set the key and timeout carried by the packet.  Returns false if the
+	// key has characters the listeners won't accept or doesn't fit.
+	bool setRecord(char const *key, int timeout, char const *lease= NULL);
+
+	// Remove all records.
+	void clear();
+
+	// Append another record.  Returns false and leaves the packet alone
+	// if the key is invalid or the record won't fit, in which case the
+	// caller should send what it has and start over.
+	//
+	// If a lease is given the key is attached to it, and the key can be
+	// empty to refresh only the lease.
+	bool addRecord(char const *key, int timeout, char const *lease= NULL);
+
+	// Stamp the packet with the given time and recompute the HMAC.  This
+	// is a no-op for simple packets.
+	bool refresh(time_t now);
+
+	// Send on a connected socket.  The return value and errno are those of
+	// send(2), so with the default flags EAGAIN means the packet was
+	// dropped rather than the caller blocking.
+	ssize_t send(int sock, int flags= MSG_DONTWAIT);
+
+	// Same as send() but for an unconnected socket.
+	ssize_t sendTo(int sock,
+		struct sockaddr const *addr, socklen_t addrLen,
+		int flags= MSG_DONTWAIT);
+
+	unsigned char const *getData() {
+		return buffer;
+	}
+	size_t getLength() {
+		return length;
+	}
+	bool isSigned() {
+		return sign;
+	}
+	int getRecordCount() {
+		return recordCount;
+	}
+
+	// Check whether a key only uses characters the listeners accept.
+	static bool ValidKey(char const *key);
+
+private:
+	KeepalivePacket(KeepalivePacket const &);
+	KeepalivePacket& operator=(KeepalivePacket const &);
+
+	unsigned char buffer[KEEPALIVE_MAX_PACKET];
+
+	// Length of the whole packet, and the offset where the payload starts
+	// (zero for simple packets, the header size for signed ones).
+	size_t length;
+	size_t payloadOffset;
+
+	int recordCount;
+	bool sign;
+
+	void setVersion();
+
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+	HMAC_CTX *hmacCtx;
+#else
+	HMAC_CTX localCtx;
+	HMAC_CTX *hmacCtx;
+#endif
+};
+
+#endif
@@ -1,12 +1,54 @@
+
 #include "system.h"
 #include "Log.h"
 
 #define FORMAT_BUFFER_LEN 1023
 
+// Lines the ring holds, which must be a power of two
+#define RING_SLOTS 1024
+
+// Most lines handed to one writev()
+#define WRITE_BATCH 64
+
+// Longest the writer sleeps before checking the ring anyway, in case a
+// wakeup was missed
+#define WRITER_POLL_MS 100
+
+// How long repeats of a message are counted instead of logged, and the
+// most messages that can be counted separately at once
+#define REPEAT_SECONDS 60
+#define MAX_REPEATS 256
+
+// Slots in the repeat table, which must be a power of two, and how many
+// slots from where a message hashes to it can end up
+#define REPEAT_SLOTS 512
+#define REPEAT_PROBES 8
+
+#define REPEAT_TAG_MASK 0xffffffff00000000ULL
+#define REPEAT_COUNT_MASK 0x00000000ffffffffULL
+
 
 std::mutex Log::mutex;
 int Log::fd= 2;
-int Log::logLevel= LOG_INFO;
+std::atomic<int> Log::logLevel(LOG_INFO);
+
+Log::Slot *Log::ring= NULL;
+std::atomic<size_t> Log::enqueuePos(0);
+size_t Log::dequeuePos= 0;
+std::atomic<uint64_t> Log::dropped(0);
+
+std::atomic<bool> Log::run(false);
+std::atomic<bool> Log::writerSleeping(false);
+std::mutex Log::wakeMutex;
+std::condition_variable Log::wake;
+std::thread *Log::writer= NULL;
+
+std::mutex Log::repeatMutex;
+Log::Repeat Log::repeats[REPEAT_SLOTS];
+std::atomic<int> Log::repeatCount(0);
+std::atomic<uint64_t> Log::overflowCount(0);
+std::atomic<time_t> Log::overflowUntil(0);
+time_t Log::nextFlush= 0;
 
 void Log::open(char const *file)
 {
@@ -32,79 +74,469 @@ void Log::open(char const *file)
 
 void Log::setLogLevel(int level)
 {
+	logLevel.store(level, std::memory_order_relaxed);
+}
+
+void Log::start()
+{
+	if (writer != NULL) {
+		return;
+	}
+
+	ring= new Slot[RING_SLOTS];
+	for (size_t i= 0; i < RING_SLOTS; i++) {
+		ring[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	run= true;
+	writer= new std::thread(&Log::writeLoop);
+
+	// Error paths exit() straight after logging, so the ring has to be
+	// written out then.
+	atexit(&Log::stop);
+}
+
+void Log::stop()
+{
+	if (writer == NULL) {
+		return;
+	}
+
+	run= false;
+	wake.notify_one();
+
+	writer->join();
+	delete writer;
+	writer= NULL;
+}
+
+// Each thread keeps the timestamp text for the current second, so
+// localtime() is called once a second rather than for every line.
+struct TimestampCache {
+	time_t second;
+	char text[80];
+};
+
+static thread_local TimestampCache timestampCache= { -1, "" };
+
+static char const *timestamp()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME_COARSE, &now);
+
+	if (now.tv_sec != timestampCache.second) {
+		struct tm bt;
+		localtime_r(&now.tv_sec, &bt);
+
+		snprintf(timestampCache.text, sizeof(timestampCache.text),
+			"%04d-%02d-%02d %02d:%02d:%02d ",
+			bt.tm_year + 1900, bt.tm_mon + 1, bt.tm_mday,
+			bt.tm_hour, bt.tm_min, bt.tm_sec);
+		timestampCache.second= now.tv_sec;
+	}
+
+	return timestampCache.text;
+}
+
+int Log::formatLine(char *buffer, int level, char const **message,
+	char const *format, va_list args)
+{
+	int bufferLen;
+
+	strcpy(buffer, timestamp());
+	char *end= &buffer[strlen(buffer)];
+
+	switch (level) {
+	case LOG_TRACE:
+		strcpy(end, "[TRACE]");
+		break;
+	case LOG_DEBUG:
+		strcpy(end, "[DEBUG]");
+		break;
+	case LOG_INFO:
+		strcpy(end, "[INFO]");
+		break;
+	case LOG_WARNING:
+		strcpy(end, "[WARNING]");
+		break;
+	case LOG_ERROR:
+		strcpy(end, "[ERROR]");
+		break;
+	case LOG_CRITICAL:
+		strcpy(end, "[ASSERT]");
+		break;
+
+	default:
+		strcpy(end, "[WTF]");
+		break;
+	}
+
+	end= &buffer[strlen(buffer)];
+	*(end++)= ' ';
+	*message= end;
+
+	bufferLen= FORMAT_BUFFER_LEN - (end - buffer) - (1 /* for NL */);
+	vsnprintf(end, bufferLen, format, args);
+	bufferLen= strlen(buffer);
+	buffer[bufferLen++]= '\n';
+	buffer[bufferLen]= '\0';
+
+	return bufferLen;
+}
+
+void Log::emit(char const *buffer, int bufferLen)
+{
+	if (run.load(std::memory_order_acquire)) {
+		if (!enqueue(buffer, bufferLen)) {
+			dropped.fetch_add(1, std::memory_order_relaxed);
+		}
+		return;
+	}
+
 	std::lock_guard<std::mutex> lock(mutex);
-	logLevel= level;
+
+	int nwrote= write(fd, buffer, bufferLen);
+
+	if (nwrote == -1) {
+		fprintf(stderr,
+			"LOG FAILURE: %d: %s\n", errno, strerror(errno));
+	} else if (nwrote != bufferLen) {
+		fprintf(stderr,
+			"LOG INCOMPLETE: %d/%d written\n", nwrote, bufferLen);
+	}
 }
 
 void Log::log(int level, char const *format, ...)
 {
-	int localLogLevel= 0;
+	if (!enabled(level)) {
+		return;
+	}
+
+	char buffer[FORMAT_BUFFER_LEN + 1];
+	char const *message;
+
+	va_list args;
+	va_start(args, format);
+	int bufferLen= formatLine(buffer, level, &message, format, args);
+	va_end(args);
+
+	emit(buffer, bufferLen);
+}
+
+// FNV-1a over the address, seeded with where the format string is
+static uint64_t repeatHash(char const *format, char const *address)
+{
+	uint64_t hash= 14695981039346656037ULL ^ (uintptr_t)format;
+	for (char const *c= address; *c != '\0'; c++) {
+		hash= (hash ^ (unsigned char)*c) * 1099511628211ULL;
+	}
+
+	return hash;
+}
+
+// The tag is never zero, so a used slot never looks free
+static uint64_t repeatTag(uint64_t hash)
+{
+	return (hash | (1ULL << 32)) & REPEAT_TAG_MASK;
+}
+
+bool Log::countRepeat(uint64_t hash)
+{
+	uint64_t tag= repeatTag(hash);
+
+	for (int i= 0; i < REPEAT_PROBES; i++) {
+		std::atomic<uint64_t>& state=
+			repeats[(hash + i) & (REPEAT_SLOTS - 1)].state;
+
+		// If the slot is flushed in the meantime the exchange fails and
+		// the tag no longer matches.
+		uint64_t current= state.load(std::memory_order_relaxed);
+		while ((current & REPEAT_TAG_MASK) == tag) {
+			if ((current & REPEAT_COUNT_MASK) == REPEAT_COUNT_MASK) {
+				return true;
+			}
+			if (state.compare_exchange_weak(current, current + 1,
+				std::memory_order_relaxed))
+			{
+				return true;
+			}
+		}
+	}
+
+	return false;
+}
+
+// With lots of sources, as with spoofed packets, anything past the table
+// is just counted together.
+void Log::countOverflow(time_t now)
+{
+	if (overflowCount.fetch_add(1, std::memory_order_relaxed) == 0) {
+		overflowUntil.store(now + REPEAT_SECONDS, std::memory_order_relaxed);
+	}
+}
+
+void Log::logRepeated(int level, char const *address,
+	char const *format, ...)
+{
+	if (!enabled(level)) {
+		return;
+	}
+
+	// Without the writer thread nothing else would flush
+	if (!run.load(std::memory_order_relaxed)) {
+		flushRepeated();
+	}
+
+	// Repeats and overflow are counted without locking or allocating,
+	// since a flood of bad packets lands here for every one.
+	uint64_t hash= repeatHash(format, address);
+	if (countRepeat(hash)) {
+		return;
+	}
+
+	time_t now= time(NULL);
+
+	if (repeatCount.load(std::memory_order_relaxed) >= MAX_REPEATS) {
+		countOverflow(now);
+		return;
+	}
+
+	char buffer[FORMAT_BUFFER_LEN + 1];
+	char const *message;
+
+	va_list args;
+	va_start(args, format);
+	int bufferLen= formatLine(buffer, level, &message, format, args);
+	va_end(args);
+
 	{
-		std::lock_guard<std::mutex> lock(mutex);
-		localLogLevel= logLevel;
+		std::lock_guard<std::mutex> lock(repeatMutex);
+
+		// Another thread may have got here first
+		if (countRepeat(hash)) {
+			return;
+		}
+
+		Repeat *repeat= NULL;
+		if (repeatCount.load(std::memory_order_relaxed) < MAX_REPEATS) {
+			for (int i= 0; (i < REPEAT_PROBES) && (repeat == NULL); i++) {
+				Repeat& slot= repeats[(hash + i) & (REPEAT_SLOTS - 1)];
+				if (slot.state.load(std::memory_order_relaxed) == 0) {
+					repeat= &slot;
+				}
+			}
+		}
+
+		if (repeat == NULL) {
+			countOverflow(now);
+			return;
+		}
+
+		repeat->level= level;
+		repeat->until= now + REPEAT_SECONDS;
+		repeat->text.assign(message, buffer + bufferLen - 1 - message);
+		repeat->state.store(repeatTag(hash), std::memory_order_relaxed);
+		repeatCount.fetch_add(1, std::memory_order_relaxed);
 	}
 
-	if (level >= localLogLevel) {
-		char buffer[FORMAT_BUFFER_LEN + 1];
-		int bufferLen;
+	emit(buffer, bufferLen);
+}
 
-		struct timeval now;
-		gettimeofday(&now, NULL);
+void Log::flushRepeated(bool all)
+{
+	time_t now= time(NULL);
+	if (!all && (now < nextFlush)) {
+		return;
+	}
+	nextFlush= now + 1;
 
-		struct tm *bt= localtime(&now.tv_sec);
+	struct Suppressed {
+		int level;
+		uint64_t count;
+		std::string text;
+	};
 
-		sprintf(buffer, "%04d-%02d-%02d %02d:%02d:%02d ",
-			bt->tm_year + 1900, bt->tm_mon + 1, bt->tm_mday,
-			bt->tm_hour, bt->tm_min, bt->tm_sec);
+	std::list<Suppressed> done;
+	uint64_t overflow= 0;
 
-		char *end= &buffer[strlen(buffer)];
+	{
+		std::lock_guard<std::mutex> lock(repeatMutex);
 
-		switch (level) {
-		case LOG_DEBUG:
-			strcpy(end, "[DEBUG]");
-			break;
-		case LOG_INFO:
-			strcpy(end, "[INFO]");
-			break;
-		case LOG_WARNING:
-			strcpy(end, "[WARNING]");
-			break;
-		case LOG_ERROR:
-			strcpy(end, "[ERROR]");
-			break;
-		case LOG_CRITICAL:
-			strcpy(end, "[ASSERT]");
-			break;
+		for (Repeat& repeat : repeats) {
+			if ((repeat.state.load(std::memory_order_relaxed) == 0) ||
+				(!all && (repeat.until > now)))
+			{
+				continue;
+			}
 
-		default:
-			strcpy(end, "[WTF]");
-			break;
+			// Clearing the state frees the slot and takes the count in
+			// one go, so no repeat is lost or counted twice.
+			uint64_t count= repeat.state.exchange(0,
+				std::memory_order_relaxed) & REPEAT_COUNT_MASK;
+			repeatCount.fetch_sub(1, std::memory_order_relaxed);
+
+			if (count > 0) {
+				Suppressed suppressed;
+				suppressed.level= repeat.level;
+				suppressed.count= count;
+				suppressed.text.swap(repeat.text);
+				done.push_back(suppressed);
+			}
 		}
+	}
+
+	if ((overflowCount.load(std::memory_order_relaxed) > 0) &&
+		(all || (overflowUntil.load(std::memory_order_relaxed) <= now)))
+	{
+		overflow= overflowCount.exchange(0, std::memory_order_relaxed);
+	}
 
-		va_list args;
-		va_start(args, format);
+	for (Suppressed const &suppressed : done) {
+		log(suppressed.level, "Suppressed %lu repeats of: %s",
+			(unsigned long)suppressed.count, suppressed.text.c_str());
+	}
+	if (overflow > 0) {
+		log(LOG_WARNING, "Suppressed %lu more messages from other sources",
+			(unsigned long)overflow);
+	}
+}
+
+// Each slot's sequence says whose turn it is: equal to a position means
+// free for the producer claiming that position, one more means filled and
+// waiting for the writer.  Returns false if the ring is full.
+bool Log::enqueue(char const *text, int length)
+{
+	size_t pos= enqueuePos.load(std::memory_order_relaxed);
+	Slot *slot;
 
-		end= &buffer[strlen(buffer)];
-		*(end++)= ' ';
+	for (;;) {
+		slot= &ring[pos & (RING_SLOTS - 1)];
+		size_t sequence= slot->sequence.load(std::memory_order_acquire);
+		intptr_t diff= (intptr_t)sequence - (intptr_t)pos;
 
-		bufferLen= FORMAT_BUFFER_LEN - (end - buffer) - (1 /* for NL */);
-		vsnprintf(end, bufferLen, format, args);
-		bufferLen= strlen(buffer);
-		buffer[bufferLen++]= '\n';
-		buffer[bufferLen]= '\0';
-		va_end(args);
+		if (diff == 0) {
+			if (enqueuePos.compare_exchange_weak(pos, pos + 1,
+				std::memory_order_relaxed))
+			{
+				break;
+			}
+		} else if (diff < 0) {
+			return false;
+		} else {
+			pos= enqueuePos.load(std::memory_order_relaxed);
+		}
+	}
 
-		std::lock_guard<std::mutex> lock(mutex);
+	memcpy(slot->text, text, length);
+	slot->length= length;
+	slot->sequence.store(pos + 1, std::memory_order_release);
 
-		int nwrote= write(fd, buffer, bufferLen);
+	// Only bother the writer if it's asleep.  The fence pairs with the
+	// writer's, so either it sees this line or we see it sleeping.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (writerSleeping.load(std::memory_order_relaxed)) {
+		wake.notify_one();
+	}
+
+	return true;
+}
 
+void Log::writeAll(struct iovec *iov, int count)
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	while (count > 0) {
+		ssize_t nwrote= writev(fd, iov, count);
 		if (nwrote == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
 			fprintf(stderr,
 				"LOG FAILURE: %d: %s\n", errno, strerror(errno));
-		} else if (nwrote != bufferLen) {
-			fprintf(stderr,
-				"LOG INCOMPLETE: %d/%d written\n", nwrote, bufferLen);
+			return;
+		}
+
+		// Skip whatever was written, which may end mid-line
+		while ((count > 0) && ((size_t)nwrote >= iov->iov_len)) {
+			nwrote-= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if (count > 0) {
+			iov->iov_base= (char *)iov->iov_base + nwrote;
+			iov->iov_len-= nwrote;
 		}
 	}
 }
 
+void Log::writeLoop()
+{
+	struct iovec iov[WRITE_BATCH + 1];
+	char notice[128];
+	bool flushed= false;
+
+	for (;;) {
+		int count= 0;
+		while (count < WRITE_BATCH) {
+			Slot *slot= &ring[(dequeuePos + count) & (RING_SLOTS - 1)];
+			if (slot->sequence.load(std::memory_order_acquire) !=
+				dequeuePos + count + 1)
+			{
+				break;
+			}
+
+			iov[count].iov_base= slot->text;
+			iov[count].iov_len= slot->length;
+			count++;
+		}
+
+		uint64_t lost= dropped.exchange(0, std::memory_order_relaxed);
+		if (lost > 0) {
+			int noticeLen= snprintf(notice, sizeof(notice),
+				"%s[WARNING] Log buffer full - dropped %lu messages\n",
+				timestamp(), (unsigned long)lost);
+
+			iov[count].iov_base= notice;
+			iov[count].iov_len= noticeLen;
+			writeAll(iov, count + 1);
+		} else if (count > 0) {
+			writeAll(iov, count);
+		}
+
+		// Hand the slots back to the producers
+		for (int i= 0; i < count; i++) {
+			ring[(dequeuePos + i) & (RING_SLOTS - 1)].sequence.store(
+				dequeuePos + i + RING_SLOTS, std::memory_order_release);
+		}
+		dequeuePos+= count;
+
+		flushRepeated();
+
+		if (count > 0) {
+			continue;
+		}
+		if (!run) {
+			// Counts still pending are logged on the way out
+			if (!flushed) {
+				flushRepeated(true);
+				flushed= true;
+				continue;
+			}
+			break;
+		}
+
+		writerSleeping.store(true, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		Slot *next= &ring[dequeuePos & (RING_SLOTS - 1)];
+		if (next->sequence.load(std::memory_order_acquire) !=
+			dequeuePos + 1)
+		{
+			std::unique_lock<std::mutex> lock(wakeMutex);
+			wake.wait_for(lock,
+				std::chrono::milliseconds(WRITER_POLL_MS));
+		}
+
+		writerSleeping.store(false, std::memory_order_relaxed);
+	}
+}
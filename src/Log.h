@@ -1,19 +1,130 @@
-#define LOG_DEBUG		0
-#define LOG_INFO		1
-#define LOG_WARNING		2
-#define LOG_ERROR		3
-#define LOG_CRITICAL	4
+#define LOG_TRACE		0
+#define LOG_DEBUG		1
+#define LOG_INFO		2
+#define LOG_WARNING		3
+#define LOG_ERROR		4
+#define LOG_CRITICAL	5
 
+// Set by configure --with-log-level
+#ifndef LOG_COMPILED_LEVEL
+#define LOG_COMPILED_LEVEL LOG_TRACE
+#endif
+
+// Use these rather than calling Log directly on paths that run for every
+// packet or entry.  A level below LOG_COMPILED_LEVEL compiles to nothing,
+// and otherwise the arguments are only evaluated if the level is enabled.
+#define LOG(level, ...) \
+	do { \
+		if (((level) >= LOG_COMPILED_LEVEL) && Log::enabled(level)) { \
+			Log::log((level), __VA_ARGS__); \
+		} \
+	} while (0)
+
+#define LOG_REPEATED(level, address, ...) \
+	do { \
+		if (((level) >= LOG_COMPILED_LEVEL) && Log::enabled(level)) { \
+			Log::logRepeated((level), (address), __VA_ARGS__); \
+		} \
+	} while (0)
+
+/**
+ * Log
+ *
+ * Once start() has been called, logging doesn't write anything itself.
+ * The caller formats the line, with a timestamp prefix that each thread
+ * only rebuilds once a second, and puts it on a lock-free ring.  A writer
+ * thread takes whatever is on the ring and writes it out with a single
+ * writev(), so a slow log disk only slows the writer.  If the ring fills
+ * up, lines are dropped and counted rather than making the caller wait.
+ *
+ * Anything still on the ring is written out at exit.  Before start() lines
+ * are written directly.
+ *
+ * logRepeated() is for messages that something outside can trigger on
+ * every packet.  The first one from a given call and source address is
+ * logged, then repeats are only counted for a while, and a line saying
+ * how many there were is logged at the end.
+ */
 class Log {
 public:
-	static void log(int, char const *, ...);
+	static void log(int, char const *, ...)
+		__attribute__((format(printf, 2, 3)));
+
+	// The format string identifies the call, so it must be a literal
+	static void logRepeated(int level, char const *address,
+		char const *format, ...)
+		__attribute__((format(printf, 3, 4)));
+
+	// Log how many times suppressed messages repeated, for any whose
+	// quiet period is over, or for all of them.  The writer thread calls
+	// this every second.
+	static void flushRepeated(bool all= false);
 
 	static void open(char const *);
 	static void setLogLevel(int);
 
+	static bool enabled(int level) {
+		return level >= logLevel.load(std::memory_order_relaxed);
+	}
+
+	static void start();
+	static void stop();
+
 private:
+	// A message being suppressed.  The state holds a tag made from the
+	// format and address in its top half and the repeat count in the
+	// bottom, so a repeat is counted without taking repeatMutex.  The
+	// rest is only touched with repeatMutex held, and a slot with a zero
+	// state is free.
+	struct Repeat {
+		std::atomic<uint64_t> state;
+		int level;
+		time_t until;
+		std::string text;
+	};
+
+	static std::mutex repeatMutex;
+	static Repeat repeats[];
+	static std::atomic<int> repeatCount;
+	static std::atomic<uint64_t> overflowCount;
+	static std::atomic<time_t> overflowUntil;
+
+	static bool countRepeat(uint64_t hash);
+	static void countOverflow(time_t now);
+
+	// Only touched by whoever calls flushRepeated
+	static time_t nextFlush;
+
+	struct Slot {
+		std::atomic<size_t> sequence;
+		int length;
+		char text[1024];
+	};
+
+	// Protects fd, and the order of direct writes before start()
 	static std::mutex mutex;
 	static int fd;
-	static int logLevel;
-};
 
+	static std::atomic<int> logLevel;
+
+	static Slot *ring;
+	static std::atomic<size_t> enqueuePos;
+	static size_t dequeuePos;
+	static std::atomic<uint64_t> dropped;
+
+	static std::atomic<bool> run;
+	static std::atomic<bool> writerSleeping;
+	static std::mutex wakeMutex;
+	static std::condition_variable wake;
+	static std::thread *writer;
+
+	// Format a line with its prefix into buffer, returning the length and
+	// where the message itself starts
+	static int formatLine(char *buffer, int level, char const **message,
+		char const *format, va_list args);
+	static void emit(char const *buffer, int length);
+
+	static bool enqueue(char const *text, int length);
+	static void writeLoop();
+	static void writeAll(struct iovec *iov, int count);
+};
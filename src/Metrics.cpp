@@ -0,0 +1,222 @@
+#include "system.h"
+
+#include "Metrics.h"
+
+struct CounterInfo {
+	char const *name;
+	char const *help;
+};
+
+// In the same order as MetricsCounter
+static CounterInfo const counterInfo[METRIC_COUNTERS]= {
+	{ "timeoutd_packets_received_total",
+		"Keepalive packets received" },
+	{ "timeoutd_packets_rate_limited_total",
+		"Packets dropped by the per-source rate limit" },
+	{ "timeoutd_parse_failures_total",
+		"Packets or records that could not be parsed" },
+	{ "timeoutd_signature_failures_total",
+		"Signed packets with a bad signature or timestamp" },
+	{ "timeoutd_records_received_total",
+		"Keepalive records received" },
+	{ "timeoutd_quota_rejections_total",
+		"New keys refused because the entry limit was reached" },
+	{ "timeoutd_relay_dropped_total",
+		"Records the relay dropped because its pending limit was reached" },
+	{ "timeoutd_entries_expired_total",
+		"Entries that timed out" },
+	{ "timeoutd_notifications_total",
+		"Timeouts handed to a notifier" },
+	{ "timeoutd_notifications_dropped_total",
+		"Timeouts dropped because a route's queue was full" },
+};
+
+// In the same order as MetricsHistogram
+static CounterInfo const histogramInfo[METRIC_HISTOGRAMS]= {
+	{ "timeoutd_ingest_seconds",
+		"Time from a packet arriving to its records being scheduled" },
+	{ "timeoutd_expiry_lateness_seconds",
+		"Time from an entry's deadline to its expiry" },
+	{ "timeoutd_queue_wait_seconds",
+		"Time expired entries waited for a notification worker" },
+	{ "timeoutd_notify_seconds",
+		"Time taken to deliver a notification" },
+};
+
+// Quantiles exported for each histogram
+static double const quantiles[]= { 0.5, 0.9, 0.99, 0.999, 1.0 };
+
+thread_local Metrics::Shard *Metrics::shard= NULL;
+
+std::mutex Metrics::mutex;
+std::list<Metrics::Shard *> Metrics::shards;
+Metrics::Totals Metrics::baseline[METRIC_HISTOGRAMS];
+
+Metrics::Shard *Metrics::addShard()
+{
+	// Shards are cache aligned so two threads never share a line
+	void *memory;
+	if (posix_memalign(&memory, alignof(Shard), sizeof(Shard)) != 0) {
+		abort();
+	}
+
+	Shard *newShard= new (memory) Shard;
+	for (int i= 0; i < METRIC_COUNTERS; i++) {
+		newShard->counters[i]= 0;
+	}
+	for (int i= 0; i < METRIC_HISTOGRAMS; i++) {
+		for (int j= 0; j < HISTOGRAM_BUCKETS; j++) {
+			newShard->buckets[i][j]= 0;
+		}
+		newShard->sums[i]= 0;
+	}
+
+	std::lock_guard<std::mutex> lock(mutex);
+	shards.push_back(newShard);
+	shard= newShard;
+
+	return newShard;
+}
+
+uint64_t Metrics::get(MetricsCounter counter)
+{
+	uint64_t total= 0;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	for (Shard *each : shards) {
+		total+= each->counters[counter].load(std::memory_order_relaxed);
+	}
+	return total;
+}
+
+// Caller holds mutex
+void Metrics::total(MetricsHistogram histogram, Totals& totals)
+{
+	Totals const &base= baseline[histogram];
+
+	totals.sum= 0;
+	totals.count= 0;
+	for (int i= 0; i < HISTOGRAM_BUCKETS; i++) {
+		totals.buckets[i]= 0;
+	}
+
+	for (Shard *each : shards) {
+		for (int i= 0; i < HISTOGRAM_BUCKETS; i++) {
+			totals.buckets[i]+=
+				each->buckets[histogram][i].load(std::memory_order_relaxed);
+		}
+		totals.sum+= each->sums[histogram].load(std::memory_order_relaxed);
+	}
+
+	// A bucket can be a count behind the baseline if it was being
+	// written while the baseline was taken
+	for (int i= 0; i < HISTOGRAM_BUCKETS; i++) {
+		totals.buckets[i]= (totals.buckets[i] > base.buckets[i]) ?
+			(totals.buckets[i] - base.buckets[i]) : 0;
+		totals.count+= totals.buckets[i];
+	}
+	totals.sum= (totals.sum > base.sum) ? (totals.sum - base.sum) : 0;
+}
+
+int64_t Metrics::percentile(Totals const &totals, double fraction)
+{
+	if (totals.count == 0) {
+		return 0;
+	}
+
+	uint64_t rank= (uint64_t)ceil(fraction * totals.count);
+	if (rank < 1) {
+		rank= 1;
+	}
+
+	uint64_t seen= 0;
+	for (int i= 0; i < HISTOGRAM_BUCKETS; i++) {
+		seen+= totals.buckets[i];
+		if (seen >= rank) {
+			return BucketTop(i);
+		}
+	}
+	return BucketTop(HISTOGRAM_BUCKETS - 1);
+}
+
+int64_t Metrics::percentile(MetricsHistogram histogram, double fraction)
+{
+	Totals totals;
+
+	std::lock_guard<std::mutex> lock(mutex);
+	total(histogram, totals);
+	return percentile(totals, fraction);
+}
+
+void Metrics::resetHistograms()
+{
+	std::lock_guard<std::mutex> lock(mutex);
+
+	for (int h= 0; h < METRIC_HISTOGRAMS; h++) {
+		Totals &base= baseline[h];
+		for (int i= 0; i < HISTOGRAM_BUCKETS; i++) {
+			base.buckets[i]= 0;
+		}
+		base.sum= 0;
+
+		for (Shard *each : shards) {
+			for (int i= 0; i < HISTOGRAM_BUCKETS; i++) {
+				base.buckets[i]+=
+					each->buckets[h][i].load(std::memory_order_relaxed);
+			}
+			base.sum+= each->sums[h].load(std::memory_order_relaxed);
+		}
+	}
+}
+
+static void appendSeconds(std::string& out, int64_t ns)
+{
+	char value[32];
+	snprintf(value, sizeof(value), "%.9f", ns / 1e9);
+	out.append(value);
+}
+
+void Metrics::format(std::string& out)
+{
+	for (int i= 0; i < METRIC_COUNTERS; i++) {
+		out.append("# HELP ");
+		out.append(counterInfo[i].name);
+		out.append(" ");
+		out.append(counterInfo[i].help);
+		out.append("\n# TYPE ");
+		out.append(counterInfo[i].name);
+		out.append(" counter\n");
+		out.append(counterInfo[i].name);
+		out.append(" ");
+		out.append(std::to_string(get((MetricsCounter)i)));
+		out.append("\n");
+	}
+
+	Totals totals;
+	for (int i= 0; i < METRIC_HISTOGRAMS; i++) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			total((MetricsHistogram)i, totals);
+		}
+
+		std::string name= histogramInfo[i].name;
+
+		out.append("# HELP " + name + " " + histogramInfo[i].help + "\n");
+		out.append("# TYPE " + name + " summary\n");
+
+		for (double quantile : quantiles) {
+			char label[32];
+			snprintf(label, sizeof(label), "{quantile=\"%g\"} ", quantile);
+
+			out.append(name + label);
+			appendSeconds(out, percentile(totals, quantile));
+			out.append("\n");
+		}
+
+		out.append(name + "_sum ");
+		appendSeconds(out, totals.sum);
+		out.append("\n" + name + "_count ");
+		out.append(std::to_string(totals.count));
+		out.append("\n");
+	}
+}
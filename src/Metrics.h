@@ -0,0 +1,164 @@
+enum MetricsCounter {
+	METRIC_PACKETS_RECEIVED,
+	METRIC_PACKETS_RATE_LIMITED,
+	METRIC_PARSE_FAILURES,
+	METRIC_SIGNATURE_FAILURES,
+	METRIC_RECORDS_RECEIVED,
+	METRIC_QUOTA_REJECTIONS,
+	METRIC_RELAY_DROPPED,
+	METRIC_ENTRIES_EXPIRED,
+	METRIC_NOTIFICATIONS,
+	METRIC_NOTIFICATIONS_DROPPED,
+
+	METRIC_COUNTERS
+};
+
+enum MetricsHistogram {
+	// Kernel receive of a packet until the scheduler has taken its records
+	HIST_INGEST,
+
+	// How long after its deadline an entry was picked up for expiry
+	HIST_EXPIRY_LATENESS,
+
+	// Time an expired entry waited for a notification worker
+	HIST_QUEUE_WAIT,
+
+	// How long a notification took to deliver
+	HIST_NOTIFY,
+
+	METRIC_HISTOGRAMS
+};
+
+// Histograms have 2^SUB_BITS linear buckets for each power of two, so a
+// recorded value is within about 6% of the truth, up to 2^MAX_BITS ns.
+#define HISTOGRAM_SUB_BITS 4
+#define HISTOGRAM_MAX_BITS 44
+#define HISTOGRAM_BUCKETS \
+	((HISTOGRAM_MAX_BITS - HISTOGRAM_SUB_BITS + 1) << HISTOGRAM_SUB_BITS)
+
+/**
+ * Metrics
+ *
+ * Counters for what the daemon is doing, cheap enough to bump on every
+ * packet.  Each thread gets its own shard of counters on its own cache
+ * line, and only that thread ever writes to it, so counting is a plain
+ * load and store with no locked instruction and no contention.  Reading
+ * a counter adds up the shards, which only happens when metrics are
+ * exported.
+ *
+ * Latencies go in log-linear histograms, kept per thread the same way.
+ * They can be reset, which only records a baseline to subtract, since
+ * only the owning thread can write to a shard.
+ *
+ * The daemon's threads live as long as it does, so shards are never
+ * freed, and a thread's counts still add up after it exits.
+ */
+class Metrics {
+public:
+	static void count(MetricsCounter counter, uint64_t n= 1) {
+		Shard *localShard= shard;
+		if (localShard == NULL) {
+			localShard= addShard();
+		}
+
+		std::atomic<uint64_t>& value= localShard->counters[counter];
+		value.store(value.load(std::memory_order_relaxed) + n,
+			std::memory_order_relaxed);
+	}
+
+	// Record a duration in nanoseconds
+	static void record(MetricsHistogram histogram, int64_t ns) {
+		Shard *localShard= shard;
+		if (localShard == NULL) {
+			localShard= addShard();
+		}
+
+		if (ns < 0) {
+			ns= 0;
+		}
+
+		std::atomic<uint64_t>& bucket=
+			localShard->buckets[histogram][Bucket(ns)];
+		bucket.store(bucket.load(std::memory_order_relaxed) + 1,
+			std::memory_order_relaxed);
+
+		std::atomic<uint64_t>& sum= localShard->sums[histogram];
+		sum.store(sum.load(std::memory_order_relaxed) + ns,
+			std::memory_order_relaxed);
+	}
+
+	// Monotonic time in nanoseconds, for timing things to record
+	static int64_t now() {
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		return (int64_t)now.tv_sec * 1000000000LL + now.tv_nsec;
+	}
+
+	// Sum of the counter over all threads
+	static uint64_t get(MetricsCounter counter);
+
+	// Value in nanoseconds below which the given fraction of recorded
+	// values fall, to the accuracy of the buckets
+	static int64_t percentile(MetricsHistogram histogram, double fraction);
+
+	// Start all histograms over from empty
+	static void resetHistograms();
+
+	// Append every counter and histogram in Prometheus text format
+	static void format(std::string& out);
+
+private:
+	struct alignas(64) Shard {
+		std::atomic<uint64_t> counters[METRIC_COUNTERS];
+		std::atomic<uint64_t> buckets[METRIC_HISTOGRAMS][HISTOGRAM_BUCKETS];
+		std::atomic<uint64_t> sums[METRIC_HISTOGRAMS];
+	};
+
+	// Histogram totals over all shards, less the baseline
+	struct Totals {
+		uint64_t buckets[HISTOGRAM_BUCKETS];
+		uint64_t sum;
+		uint64_t count;
+	};
+
+	static thread_local Shard *shard;
+
+	static std::mutex mutex;
+	static std::list<Shard *> shards;
+
+	// What the histograms held when last reset, protected by mutex
+	static Totals baseline[METRIC_HISTOGRAMS];
+
+	static Shard *addShard();
+
+	static void total(MetricsHistogram histogram, Totals& totals);
+	static int64_t percentile(Totals const &totals, double fraction);
+
+	static int Bucket(int64_t ns) {
+		uint64_t value= ns;
+		if (value >= (1ULL << HISTOGRAM_MAX_BITS)) {
+			value= (1ULL << HISTOGRAM_MAX_BITS) - 1;
+		}
+		if (value < (1ULL << HISTOGRAM_SUB_BITS)) {
+			return value;
+		}
+
+		// The top bit picks the power of two and the next SUB_BITS the
+		// linear bucket within it
+		int exponent= 63 - __builtin_clzll(value);
+		int shift= exponent - HISTOGRAM_SUB_BITS;
+		return ((shift + 1) << HISTOGRAM_SUB_BITS) +
+			(int)((value >> shift) - (1ULL << HISTOGRAM_SUB_BITS));
+	}
+
+	// Largest value that lands in the bucket
+	static int64_t BucketTop(int bucket) {
+		if (bucket < (1 << HISTOGRAM_SUB_BITS)) {
+			return bucket;
+		}
+		int shift= (bucket >> HISTOGRAM_SUB_BITS) - 1;
+		uint64_t mantissa= (1ULL << HISTOGRAM_SUB_BITS) +
+			(bucket & ((1 << HISTOGRAM_SUB_BITS) - 1));
+		return (int64_t)(((mantissa + 1) << shift) - 1);
+	}
+};
@@ -0,0 +1,240 @@
+#include "system.h"
+
+#include "Log.h"
+#include "Metrics.h"
+#include "MetricsServer.h"
+
+// Longest request we'll read, and how long we'll wait for it
+#define MAX_REQUEST 4096
+#define REQUEST_TIMEOUT_MS 2000
+
+MetricsServer::MetricsServer(std::string const &host, int port)
+{
+	this->host= host;
+	this->port= port;
+
+	listenFd= -1;
+	stopPipe[0]= -1;
+	stopPipe[1]= -1;
+
+	run= false;
+	thread= NULL;
+}
+
+MetricsServer::~MetricsServer()
+{
+}
+
+std::shared_ptr<MetricsServer> MetricsServer::Create(char const *spec)
+{
+	std::shared_ptr<MetricsServer> rval;
+
+	std::string host= "127.0.0.1";
+	char const *portText= spec;
+
+	char const *colon= strrchr(spec, ':');
+	if (colon != NULL) {
+		host.assign(spec, colon - spec);
+		portText= colon + 1;
+
+		// IPv6 literals can be in brackets
+		if ((host.size() >= 2) && (host.front() == '[') &&
+			(host.back() == ']'))
+		{
+			host= host.substr(1, host.size() - 2);
+		}
+	}
+
+	char *end;
+	int port= strtol(portText, &end, 10);
+	if (host.empty() || (*end != '\0') || (port < 1) || (port > 65535)) {
+		Log::log(LOG_ERROR, "Invalid metrics address %s", spec);
+		return rval;
+	}
+
+	rval= std::make_shared<MetricsServer>(host, port);
+	return rval;
+}
+
+void MetricsServer::addGauge(char const *name, char const *help,
+	std::function<double()> read)
+{
+	Gauge gauge;
+	gauge.name= name;
+	gauge.help= help;
+	gauge.read= read;
+
+	gauges.push_back(gauge);
+}
+
+bool MetricsServer::start()
+{
+	char portText[16];
+	snprintf(portText, sizeof(portText), "%d", port);
+
+	struct addrinfo hints;
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_flags= AI_NUMERICHOST | AI_PASSIVE;
+	hints.ai_family= AF_UNSPEC;
+	hints.ai_socktype= SOCK_STREAM;
+
+	struct addrinfo *hostInfo;
+	int lookupRval= getaddrinfo(host.c_str(), portText, &hints, &hostInfo);
+	if (lookupRval != 0) {
+		Log::log(LOG_ERROR, "Invalid metrics address %s: %s",
+			host.c_str(), gai_strerror(lookupRval));
+		return false;
+	}
+
+	listenFd= socket(hostInfo->ai_family,
+		hostInfo->ai_socktype | SOCK_CLOEXEC, hostInfo->ai_protocol);
+
+	int one= 1;
+	if ((listenFd == -1) ||
+		(setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR,
+			&one, sizeof(one)) == -1) ||
+		(bind(listenFd, hostInfo->ai_addr, hostInfo->ai_addrlen) == -1) ||
+		(listen(listenFd, 16) == -1))
+	{
+		Log::log(LOG_ERROR, "Unable to listen for metrics on %s port %d: %s",
+			host.c_str(), port, strerror(errno));
+		freeaddrinfo(hostInfo);
+		if (listenFd != -1) {
+			close(listenFd);
+			listenFd= -1;
+		}
+		return false;
+	}
+	freeaddrinfo(hostInfo);
+
+	if (pipe2(stopPipe, O_CLOEXEC) == -1) {
+		Log::log(LOG_ERROR, "Unable to create metrics stop pipe: %s",
+			strerror(errno));
+		return false;
+	}
+
+	run= true;
+	thread= new std::thread(&MetricsServer::loop, this);
+
+	Log::log(LOG_DEBUG, "Serving metrics on %s port %d", host.c_str(), port);
+	return true;
+}
+
+void MetricsServer::stop()
+{
+	run= false;
+	if (write(stopPipe[1], "\0", 1) == -1) {
+		Log::log(LOG_ERROR, "Error writing to metrics stop pipe: %s",
+			strerror(errno));
+	}
+
+	thread->join();
+	delete thread;
+	thread= NULL;
+
+	close(listenFd);
+	close(stopPipe[0]);
+	close(stopPipe[1]);
+}
+
+void MetricsServer::loop()
+{
+	while (run) {
+		struct pollfd pollFds[2];
+		pollFds[0].fd= listenFd;
+		pollFds[0].events= POLLIN;
+		pollFds[1].fd= stopPipe[0];
+		pollFds[1].events= POLLIN;
+
+		if (poll(pollFds, 2, -1) == -1) {
+			if (errno != EINTR) {
+				Log::log(LOG_ERROR, "Error waiting for metrics clients: %s",
+					strerror(errno));
+				sleep(1);
+			}
+			continue;
+		}
+
+		if (pollFds[0].revents & POLLIN) {
+			int fd= accept4(listenFd, NULL, NULL, SOCK_CLOEXEC);
+			if (fd != -1) {
+				serve(fd);
+				close(fd);
+			}
+		}
+	}
+}
+
+static void sendAll(int fd, std::string const &data)
+{
+	size_t sent= 0;
+	while (sent < data.size()) {
+		ssize_t sendRval= send(fd, data.data() + sent, data.size() - sent,
+			MSG_NOSIGNAL);
+		if (sendRval > 0) {
+			sent+= sendRval;
+		} else if ((sendRval == -1) && (errno == EINTR)) {
+			continue;
+		} else {
+			return;
+		}
+	}
+}
+
+void MetricsServer::serve(int fd)
+{
+	// A scraper that connects and says nothing mustn't hold us up
+	struct timeval tv;
+	tv.tv_sec= REQUEST_TIMEOUT_MS / 1000;
+	tv.tv_usec= (REQUEST_TIMEOUT_MS % 1000) * 1000;
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+	std::string request;
+	while (request.find("\r\n\r\n") == std::string::npos) {
+		char buffer[1024];
+		ssize_t readRval= recv(fd, buffer, sizeof(buffer), 0);
+		if ((readRval == -1) && (errno == EINTR)) {
+			continue;
+		}
+		if ((readRval <= 0) || (request.size() + readRval > MAX_REQUEST)) {
+			return;
+		}
+		request.append(buffer, readRval);
+	}
+
+	std::string status;
+	std::string body;
+
+	if ((request.compare(0, 13, "GET /metrics ") == 0) ||
+		(request.compare(0, 6, "GET / ") == 0))
+	{
+		status= "200 OK";
+		Metrics::format(body);
+
+		for (Gauge const &gauge : gauges) {
+			char value[64];
+			snprintf(value, sizeof(value), "%.17g", gauge.read());
+
+			body.append("# HELP " + gauge.name + " " + gauge.help + "\n");
+			body.append("# TYPE " + gauge.name + " gauge\n");
+			body.append(gauge.name + " " + value + "\n");
+		}
+	} else if (request.compare(0, 12, "POST /reset ") == 0) {
+		// Histograms start over, so a test run can be measured alone
+		status= "200 OK";
+		Metrics::resetHistograms();
+		body= "Histograms reset\n";
+	} else {
+		status= "404 Not Found";
+		body= "Not found\n";
+	}
+
+	std::string response= "HTTP/1.1 " + status + "\r\n";
+	response.append("Content-Type: text/plain; version=0.0.4\r\n");
+	response.append("Content-Length: " + std::to_string(body.size()));
+	response.append("\r\nConnection: close\r\n\r\n");
+	response.append(body);
+
+	sendAll(fd, response);
+}
@@ -0,0 +1,49 @@
+/**
+ * MetricsServer
+ *
+ * Serves the counters from Metrics, plus any gauges added here, over HTTP
+ * in the Prometheus text format.  It answers GET /metrics, and POST /reset
+ * to empty the histograms, one request per connection, from a single
+ * thread, which is plenty for a scraper calling every few seconds.
+ *
+ * Gauges are read by calling a function at scrape time, so things like
+ * the number of live entries cost nothing until somebody asks.
+ */
+class MetricsServer {
+public:
+	MetricsServer(std::string const &host, int port);
+	virtual ~MetricsServer();
+
+	void addGauge(char const *name, char const *help,
+		std::function<double()> read);
+
+	bool start();
+	void stop();
+
+	// Parses "port" or "host:port".  Without a host only the loopback
+	// address is used, since the metrics aren't meant for everybody.
+	static std::shared_ptr<MetricsServer> Create(char const *spec);
+
+private:
+	struct Gauge {
+		std::string name;
+		std::string help;
+		std::function<double()> read;
+	};
+
+	std::string host;
+	int port;
+
+	std::list<Gauge> gauges;
+
+	int listenFd;
+	int stopPipe[2];
+
+	volatile bool run;
+	std::thread *thread;
+
+	void loop();
+	void serve(int fd);
+};
+
+typedef std::shared_ptr<MetricsServer> MetricsServerRef;
@@ -161,8 +161,7 @@ bool Multicast::scanInterfaces(int sock, struct ifconf &conf)
 
 				if (!alreadyWarned) {
 					Log::log(LOG_ERROR,
-						"SIOCGIFPFLAGS->EINVAL - your kernel is too old",
-						strerror(errno));
+						"SIOCGIFPFLAGS->EINVAL - your kernel is too old");
 					alreadyWarned= true;
 				}
 			} else {
@@ -284,7 +283,7 @@ bool Multicast::init(int ip4Ttl)
 		success= false;
 	}
 
-	int sock= socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+	int sock= socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_IP);
 	if (sock == -1) {
 		Log::log(LOG_ERROR,
 			"Unable to open sock to query interfaces: %s",
@@ -0,0 +1,23 @@
+#include "system.h"
+
+#include "Notifier.h"
+
+Notifier::Notifier()
+{
+}
+
+Notifier::~Notifier()
+{
+}
+
+void Notifier::notifyBatch(EntryBatch const &batch)
+{
+	for (EntryRef entry : batch) {
+		notify(entry);
+	}
+}
+
+void Notifier::notifyGroup(EntryBatch const &group)
+{
+	notifyBatch(group);
+}
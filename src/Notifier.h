@@ -0,0 +1,38 @@
+
+class Entry;
+typedef std::shared_ptr<Entry> EntryRef;
+
+// Entries that expired around the same time, handed over together
+typedef std::vector<EntryRef> EntryBatch;
+
+// Most entries a worker takes from the scheduler at once
+#define MAX_WORK_BATCH 64
+
+/**
+ * Notifier
+ *
+ * Generic interface for something that delivers notifications for expired
+ * entries.  The workers hand entries to a notifier, so notify() should get
+ * the work going and return rather than waiting for it to finish.
+ */
+class Notifier {
+public:
+	Notifier();
+	virtual ~Notifier();
+
+	virtual bool start() = 0;
+	virtual void stop() = 0;
+
+	virtual void notify(EntryRef entry) = 0;
+
+	// The workers call this with whatever was waiting when they asked for
+	// work.  By default it's the same as calling notify() for each entry.
+	virtual void notifyBatch(EntryBatch const &batch);
+
+	// Deliver a single notification that covers all of the entries, for a
+	// group the coalescer put together.  Notifiers that can't express that
+	// treat it as a batch.
+	virtual void notifyGroup(EntryBatch const &group);
+};
+
+typedef std::shared_ptr<Notifier> NotifierRef;
@@ -0,0 +1,87 @@
+#include "system.h"
+
+#include "Log.h"
+#include "Metrics.h"
+#include "Receiver.h"
+#include "Payload.h"
+
+// Timeout used when a record doesn't specify one
+#define DEFAULT_TIMEOUT 30
+
+// Records are copied here to terminate them.  This is bigger than any
+// datagram the listeners will read.
+#define RECORD_BUFFER_SIZE 2048
+
+bool Payload::Parse(
+	char const *data,
+	socklen_t dataLen,
+	char const *address,
+	Receiver *receiver,
+	bool multiRecord)
+{
+	for (socklen_t i= 0; i < dataLen; i++) {
+		if (!isalnum(data[i]) && (data[i] != '.') && (data[i] != ':') &&
+			(data[i] != '@') && !(multiRecord && (data[i] == '\n')))
+		{
+			LOG_REPEATED(LOG_WARNING, address,
+				"Invalid ASCII in packet from %s at position %d",
+				address, i);
+			Metrics::count(METRIC_PARSE_FAILURES);
+
+			return false;
+		}
+	}
+
+	char record[RECORD_BUFFER_SIZE];
+
+	char const *end= data + dataLen;
+	for (char const *start= data; start < end; ) {
+		char const *next= static_cast<char const *>(
+			memchr(start, '\n', end - start));
+		if (next == NULL) {
+			next= end;
+		}
+
+		size_t recordLen= next - start;
+		if (recordLen >= RECORD_BUFFER_SIZE) {
+			LOG_REPEATED(LOG_WARNING, address,
+				"Record from %s is too long", address);
+			Metrics::count(METRIC_PARSE_FAILURES);
+		} else if (recordLen > 0) {
+			memcpy(record, start, recordLen);
+			record[recordLen]= '\0';
+
+			int timeout= DEFAULT_TIMEOUT;
+
+			char *colon= strchr(record, ':');
+			if (colon != NULL) {
+				*colon= '\0';
+				timeout= atoi(colon + 1);
+			}
+
+			char *lease= strchr(record, '@');
+			if (lease != NULL) {
+				*(lease++)= '\0';
+			}
+
+			if ((lease != NULL) &&
+				((*lease == '\0') || (strchr(lease, '@') != NULL)))
+			{
+				LOG_REPEATED(LOG_WARNING, address,
+					"Record from %s has an invalid lease name", address);
+				Metrics::count(METRIC_PARSE_FAILURES);
+			} else if ((*record == '\0') && (lease == NULL)) {
+				LOG_REPEATED(LOG_WARNING, address,
+					"Record from %s has no key or lease", address);
+				Metrics::count(METRIC_PARSE_FAILURES);
+			} else {
+				Metrics::count(METRIC_RECORDS_RECEIVED);
+				receiver->receive(record, lease, timeout, address);
+			}
+		}
+
+		start= next + 1;
+	}
+
+	return true;
+}
@@ -0,0 +1,23 @@
+
+class Receiver;
+
+/**
+ * Payload
+ *
+ * Decoder for the text payload shared by the simple and signed protocols.
+ * A payload is one or more records of the form "key" or "key:timeout",
+ * separated by newlines when the packet carries more than one.
+ *
+ * A key can be followed by "@lease" to attach it to a lease, and a record
+ * with only "@lease" refreshes the lease and everything attached to it.
+ */
+class Payload {
+public:
+	// Decode the payload and pass each record to the receiver.  If
+	// multiRecord is false a newline is treated as an invalid character,
+	// which is how version 1 signed packets are defined.  Returns false
+	// if the payload was rejected.
+	static bool Parse(
+		char const *data, socklen_t dataLen, char const *address,
+		Receiver *receiver, bool multiRecord);
+};
@@ -0,0 +1,145 @@
+#include "system.h"
+
+#include "Log.h"
+#include "Metrics.h"
+#include "Entry.h"
+#include "Notifier.h"
+#include "plugin.h"
+#include "PluginNotifier.h"
+
+PluginNotifier::PluginNotifier(char const *path, char const *argument)
+{
+	this->path= path;
+	if (argument != NULL) {
+		this->argument= argument;
+		hasArgument= true;
+	} else {
+		hasArgument= false;
+	}
+
+	handle= NULL;
+	state= NULL;
+
+	pluginInit= NULL;
+	pluginNotify= NULL;
+	pluginShutdown= NULL;
+}
+
+PluginNotifier::~PluginNotifier()
+{
+}
+
+std::shared_ptr<PluginNotifier> PluginNotifier::Create(char const *spec)
+{
+	std::string path= spec;
+	std::shared_ptr<PluginNotifier> rval;
+
+	size_t comma= path.find(',');
+	if (comma == std::string::npos) {
+		rval= std::make_shared<PluginNotifier>(path.c_str(), (char *)NULL);
+	} else {
+		std::string argument= path.substr(comma + 1);
+		path.erase(comma);
+
+		rval= std::make_shared<PluginNotifier>(
+			path.c_str(), argument.c_str());
+	}
+
+	return rval;
+}
+
+void *PluginNotifier::lookup(char const *name)
+{
+	void *rval= dlsym(handle, name);
+	if (rval == NULL) {
+		Log::log(LOG_ERROR, "Plugin %s doesn't export %s",
+			path.c_str(), name);
+	}
+	return rval;
+}
+
+bool PluginNotifier::start()
+{
+	handle= dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+	if (handle == NULL) {
+		Log::log(LOG_ERROR, "Unable to load plugin: %s", dlerror());
+		return false;
+	}
+
+	pluginInit= (timeoutd_plugin_init_t)lookup("timeoutd_plugin_init");
+	pluginNotify= (timeoutd_plugin_notify_t)lookup("timeoutd_plugin_notify");
+	pluginShutdown=
+		(timeoutd_plugin_shutdown_t)lookup("timeoutd_plugin_shutdown");
+
+	if ((pluginInit == NULL) || (pluginNotify == NULL) ||
+		(pluginShutdown == NULL))
+	{
+		dlclose(handle);
+		handle= NULL;
+		return false;
+	}
+
+	int initRval= pluginInit(TIMEOUTD_PLUGIN_ABI_VERSION,
+		hasArgument ? argument.c_str() : NULL, &state);
+
+	if (initRval != 0) {
+		Log::log(LOG_ERROR, "Plugin %s failed to initialize (%d)",
+			path.c_str(), initRval);
+		dlclose(handle);
+		handle= NULL;
+		return false;
+	}
+
+	Log::log(LOG_INFO, "Loaded notification plugin %s", path.c_str());
+	return true;
+}
+
+void PluginNotifier::stop()
+{
+	if (handle != NULL) {
+		std::lock_guard<std::mutex> lock(mutex);
+
+		pluginShutdown(state);
+		dlclose(handle);
+		handle= NULL;
+	}
+}
+
+void PluginNotifier::notify(EntryRef entry)
+{
+	struct timeoutd_expiry expiry;
+	expiry.key= entry->getKey();
+	expiry.address= entry->getLastAddress();
+
+	std::lock_guard<std::mutex> lock(mutex);
+	int64_t started= Metrics::now();
+	pluginNotify(state, &expiry, 1);
+	Metrics::record(HIST_NOTIFY, Metrics::now() - started);
+}
+
+void PluginNotifier::notifyBatch(EntryBatch const &batch)
+{
+	// The workers never take more than MAX_WORK_BATCH at a time, and
+	// anything bigger is passed to the plugin in pieces.
+	struct timeoutd_expiry expiries[MAX_WORK_BATCH];
+
+	size_t offset= 0;
+	while (offset < batch.size()) {
+		size_t count= 0;
+		while ((count < MAX_WORK_BATCH) && (offset + count < batch.size())) {
+			EntryRef const &entry= batch[offset + count];
+			expiries[count].key= entry->getKey();
+			expiries[count].address= entry->getLastAddress();
+			count++;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			int64_t started= Metrics::now();
+			pluginNotify(state, expiries, count);
+			Metrics::record(HIST_NOTIFY, Metrics::now() - started);
+		}
+
+		offset+= count;
+	}
+}
@@ -0,0 +1,45 @@
+/**
+ * PluginNotifier
+ *
+ * Notifies by calling into a shared object loaded with dlopen(), so expired
+ * entries can be handled without creating a process at all.  The interface
+ * the plugin implements is in plugin.h.
+ *
+ * The workers call the plugin directly with each batch they take from the
+ * scheduler.  Calls are serialized so the plugin doesn't need its own
+ * locking.
+ */
+class PluginNotifier : public Notifier {
+public:
+	PluginNotifier(char const *path, char const *argument);
+	virtual ~PluginNotifier();
+
+	virtual bool start();
+	virtual void stop();
+
+	virtual void notify(EntryRef entry);
+	virtual void notifyBatch(EntryBatch const &batch);
+
+	// The spec is the path to the shared object, optionally followed by a
+	// comma and an argument to pass to the plugin.
+	static std::shared_ptr<PluginNotifier> Create(char const *spec);
+
+private:
+	std::string path;
+	std::string argument;
+	bool hasArgument;
+
+	void *handle;
+	void *state;
+
+	timeoutd_plugin_init_t pluginInit;
+	timeoutd_plugin_notify_t pluginNotify;
+	timeoutd_plugin_shutdown_t pluginShutdown;
+
+	// Held across calls into the plugin
+	std::mutex mutex;
+
+	void *lookup(char const *name);
+};
+
+typedef std::shared_ptr<PluginNotifier> PluginNotifierRef;
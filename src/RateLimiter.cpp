@@ -0,0 +1,158 @@
+#include "system.h"
+
+#include "Log.h"
+#include "Metrics.h"
+#include "RateLimiter.h"
+
+// Slots are grouped into sets of WAYS, so the table holds up to
+// SETS * WAYS sources at once.
+#define SETS 2048
+#define WAYS 4
+
+// How often to log a summary of drops
+#define SUMMARY_SECONDS 60
+
+#define NS_PER_SECOND 1000000000LL
+
+static int64_t monotonicNs()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t)now.tv_sec * NS_PER_SECOND + now.tv_nsec;
+}
+
+// Mix the address bytes with a per-run seed, so nobody can pick addresses
+// that all land in the same set and push out a well-behaved source.
+static uint64_t hashAddress(uint8_t const *address, uint64_t seed)
+{
+	uint64_t high, low;
+	memcpy(&high, address, 8);
+	memcpy(&low, address + 8, 8);
+
+	uint64_t hash= (high ^ seed) * 0x9e3779b97f4a7c15ULL;
+	hash^= low + (hash >> 29);
+	hash*= 0xbf58476d1ce4e5b9ULL;
+	return hash ^ (hash >> 32);
+}
+
+RateLimiter::RateLimiter(double rate, double burst)
+{
+	this->rate= rate;
+	this->burst= burst;
+
+	std::random_device random;
+	seed= ((uint64_t)random() << 32) | random();
+
+	slots= new Slot[SETS * WAYS];
+	memset(slots, 0, sizeof(Slot) * SETS * WAYS);
+
+	summaryInterval= 1;
+	summaryAt= monotonicNs() + SUMMARY_SECONDS * NS_PER_SECOND;
+	intervalDropped= 0;
+	intervalSources= 0;
+}
+
+RateLimiter::~RateLimiter()
+{
+	delete[] slots;
+}
+
+std::shared_ptr<RateLimiter> RateLimiter::Create(char const *spec)
+{
+	std::shared_ptr<RateLimiter> rval;
+
+	char *end;
+	double rate= strtod(spec, &end);
+	double burst= rate;
+
+	if (*end == ',') {
+		burst= strtod(end + 1, &end);
+	}
+
+	if ((*end != '\0') || !(rate > 0) || !(burst >= 1)) {
+		Log::log(LOG_ERROR, "Invalid rate limit %s", spec);
+		return rval;
+	}
+
+	rval= std::make_shared<RateLimiter>(rate, burst);
+	return rval;
+}
+
+bool RateLimiter::allow(int family, void const *address)
+{
+	// IPv4 addresses are stored mapped into IPv6 so they share the table
+	uint8_t key[16];
+	if (family == AF_INET) {
+		memset(key, 0, 10);
+		key[10]= 0xff;
+		key[11]= 0xff;
+		memcpy(key + 12, address, 4);
+	} else {
+		memcpy(key, address, 16);
+	}
+
+	Slot *set= slots + (hashAddress(key, seed) % SETS) * WAYS;
+	int64_t now= monotonicNs();
+
+	std::lock_guard<std::mutex> lock(mutex);
+
+	if (now >= summaryAt) {
+		summarize(now);
+	}
+
+	Slot *slot= NULL;
+	Slot *oldest= set;
+	for (int i= 0; i < WAYS; i++) {
+		if (set[i].used && (memcmp(set[i].address, key, 16) == 0)) {
+			slot= set + i;
+			break;
+		}
+		if (!set[i].used) {
+			oldest= set + i;
+		} else if (oldest->used && (set[i].lastSeen < oldest->lastSeen)) {
+			oldest= set + i;
+		}
+	}
+
+	if (slot == NULL) {
+		slot= oldest;
+		memcpy(slot->address, key, 16);
+		slot->used= true;
+		slot->tokens= burst;
+		slot->limitedInterval= 0;
+	} else {
+		slot->tokens+= (now - slot->lastSeen) * rate / NS_PER_SECOND;
+		if (slot->tokens > burst) {
+			slot->tokens= burst;
+		}
+	}
+	slot->lastSeen= now;
+
+	if (slot->tokens >= 1) {
+		slot->tokens-= 1;
+		return true;
+	}
+
+	Metrics::count(METRIC_PACKETS_RATE_LIMITED);
+	intervalDropped++;
+	if (slot->limitedInterval != summaryInterval) {
+		slot->limitedInterval= summaryInterval;
+		intervalSources++;
+	}
+	return false;
+}
+
+void RateLimiter::summarize(int64_t now)
+{
+	if (intervalDropped > 0) {
+		Log::log(LOG_WARNING,
+			"Rate limit dropped %lu packets from %lu sources in the last "
+			"%d seconds", intervalDropped, intervalSources,
+			SUMMARY_SECONDS);
+	}
+
+	summaryInterval++;
+	summaryAt= now + SUMMARY_SECONDS * NS_PER_SECOND;
+	intervalDropped= 0;
+	intervalSources= 0;
+}
@@ -0,0 +1,55 @@
+/**
+ * RateLimiter
+ *
+ * Per-source token buckets checked by the listeners before a packet is
+ * parsed, so a single host flooding keepalives is dropped without costing
+ * any parsing or scheduler work.  Each source may send a burst of packets
+ * and then rate packets a second on average.
+ *
+ * Sources are kept in a fixed-size table that never allocates.  A source
+ * hashes to a small set of slots, and when the set is full the source
+ * seen least recently is evicted.  An evicted source comes back with a
+ * full bucket, so the limit is approximate when there are more active
+ * sources than slots.
+ *
+ * Drops aren't logged one at a time.  They're counted in the metrics, and
+ * a summary is logged at most once a minute while drops are happening.
+ */
+class RateLimiter {
+public:
+	RateLimiter(double rate, double burst);
+	virtual ~RateLimiter();
+
+	// Address is an in_addr or in6_addr depending on family.  Returns false
+	// if the packet should be dropped.
+	bool allow(int family, void const *address);
+
+	// Parses "rate" or "rate,burst", where burst defaults to rate
+	static std::shared_ptr<RateLimiter> Create(char const *spec);
+
+private:
+	struct Slot {
+		uint8_t address[16];
+		bool used;
+		double tokens;
+		int64_t lastSeen;
+		uint64_t limitedInterval;
+	};
+
+	double rate;
+	double burst;
+	uint64_t seed;
+
+	Slot *slots;
+	std::mutex mutex;
+
+	// Protected by mutex
+	uint64_t summaryInterval;
+	int64_t summaryAt;
+	uint64_t intervalDropped;
+	uint64_t intervalSources;
+
+	void summarize(int64_t now);
+};
+
+typedef std::shared_ptr<RateLimiter> RateLimiterRef;
@@ -0,0 +1,11 @@
+#include "system.h"
+
+#include "Receiver.h"
+
+Receiver::Receiver()
+{
+}
+
+Receiver::~Receiver()
+{
+}
@@ -0,0 +1,21 @@
+
+/**
+ * Receiver
+ *
+ * Generic interface for something that accepts decoded keepalives from the
+ * listeners.  Normally this is the scheduler, but in relay mode it's the
+ * relay that forwards them upstream.
+ */
+class Receiver {
+public:
+	Receiver();
+	virtual ~Receiver();
+
+	// The lease is NULL for an ordinary keepalive.  Otherwise the key is
+	// attached to the named lease, or is empty for a refresh of just the
+	// lease.
+	virtual void receive(char const *key, char const *lease,
+		int timeout, char const *address) = 0;
+};
+
+typedef std::shared_ptr<Receiver> ReceiverRef;
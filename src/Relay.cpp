@@ -0,0 +1,144 @@
+#include "system.h"
+
+#include "Log.h"
+#include "Metrics.h"
+#include "Sender.h"
+#include "UdpSender.h"
+#include "Receiver.h"
+#include "KeepalivePacket.h"
+#include "Relay.h"
+
+Relay::Relay(
+	struct sockaddr *addr,
+	socklen_t addrLen,
+	int frequency,
+	char const *preSharedKey,
+	int pendingLimit) :
+	UdpSender(addr, addrLen, frequency)
+{
+	this->pendingLimit= pendingLimit;
+
+	if (preSharedKey != NULL) {
+		if (!packet.setPreSharedKey(preSharedKey)) {
+			Log::log(LOG_ERROR, "Failed to init HMAC");
+		}
+	}
+}
+
+Relay::~Relay()
+{
+}
+
+RelayRef Relay::Create(
+	char const *host,
+	int port,
+	int frequency,
+	char const *preSharedKey,
+	int pendingLimit)
+{
+	RelayRef rval;
+
+	unsigned char addressBuffer[sizeof(struct sockaddr_in6)];
+	struct sockaddr *address=
+		reinterpret_cast<struct sockaddr *>(addressBuffer);
+
+	socklen_t addressLen= sizeof(addressBuffer);
+
+	if (ParseAddress(host, port, address, addressLen)) {
+		rval= std::make_shared<Relay>(
+			address, addressLen, frequency, preSharedKey, pendingLimit);
+	}
+
+	return rval;
+}
+
+void Relay::receive(
+	char const *key, char const *lease, int timeout, char const *address)
+{
+	if ((*key == '\0') && (lease == NULL)) {
+		return;
+	}
+
+	std::string name;
+	if (*key != '\0') {
+		name= key;
+	} else {
+		name= "@";
+		name.append(lease);
+	}
+
+	std::lock_guard<std::mutex> lock(pendingLock);
+
+	auto nameIter= pending.find(name);
+	if (nameIter == pending.end()) {
+		if ((int)pending.size() >= pendingLimit) {
+			LOG_REPEATED(LOG_WARNING, address,
+				"Cannot relay key from %s - pending count %d is at quota",
+				address, pendingLimit);
+			Metrics::count(METRIC_RELAY_DROPPED);
+			return;
+		}
+
+		nameIter= pending.insert(
+			std::pair<std::string, Record>(name, Record())).first;
+	}
+
+	nameIter->second.lease= (lease != NULL) ? lease : "";
+	nameIter->second.timeout= timeout;
+}
+
+void Relay::sendPacket(int sock)
+{
+	std::map<std::string, Record> batch;
+	{
+		std::lock_guard<std::mutex> lock(pendingLock);
+		batch.swap(pending);
+	}
+
+	packet.clear();
+	for (auto const &entry : batch) {
+		char const *key= entry.first.c_str();
+		char const *lease= NULL;
+
+		if (!entry.second.lease.empty()) {
+			lease= entry.second.lease.c_str();
+			if (*key == '@') {
+				key= "";
+			}
+		}
+
+		if (!packet.addRecord(key, entry.second.timeout, lease)) {
+			if (packet.getRecordCount() > 0) {
+				flush(sock);
+				packet.clear();
+			}
+
+			if (!packet.addRecord(key, entry.second.timeout, lease)) {
+				Log::log(LOG_WARNING,
+					"Unable to relay key %s", entry.first.c_str());
+			}
+		}
+	}
+
+	if (packet.getRecordCount() > 0) {
+		flush(sock);
+	}
+}
+
+void Relay::flush(int sock)
+{
+	time_t now;
+	time(&now);
+
+	if (!packet.refresh(now)) {
+		Log::log(LOG_ERROR, "Failed to compute HMAC");
+	} else if (packet.send(sock, 0) == -1) {
+		// Same as the senders, a refused connection just means the
+		// upstream isn't listening yet.
+		if (errno != ECONNREFUSED) {
+			Log::log(LOG_ERROR,
+				"Error sending relay packet: %s",
+				strerror(errno));
+		}
+	}
+}
@@ -0,0 +1,54 @@
+
+/**
+ * Relay
+ *
+ * In relay mode the listeners hand keepalives to a Relay instead of the
+ * scheduler.  The relay coalesces them by key, and on a fixed cadence sends
+ * everything it saw since the last round to an upstream timeoutd, packed
+ * into as few multi-record datagrams as possible.
+ *
+ * The upstream only sees the keys, so notifications it sends will carry
+ * the address of the relay rather than the original host.
+ */
+class Relay : public UdpSender, public Receiver {
+protected:
+	virtual void sendPacket(int sock);
+
+public:
+	Relay(
+		struct sockaddr *addr,
+		socklen_t addrLen,
+		int frequency,
+		char const *preSharedKey,
+		int pendingLimit);
+
+	virtual ~Relay();
+
+	virtual void receive(char const *key, char const *lease,
+		int timeout, char const *address);
+
+	// Pass NULL for the pre-shared key to use the simple protocol.
+	static std::shared_ptr<Relay> Create(
+		char const *address, int port, int frequency,
+		char const *preSharedKey, int pendingLimit);
+
+private:
+	void flush(int sock);
+
+	// Latest lease and timeout received for a key
+	struct Record {
+		std::string lease;
+		int timeout;
+	};
+
+	// Keys received since the last round.  Refreshes of a lease alone are
+	// kept under "@" and the lease name, which can't collide with a key.
+	std::map<std::string, Record> pending;
+	std::mutex pendingLock;
+
+	int pendingLimit;
+
+	KeepalivePacket packet;
+};
+
+typedef std::shared_ptr<Relay> RelayRef;
@@ -0,0 +1,71 @@
+#include "system.h"
+
+#include "Log.h"
+#include "Metrics.h"
+#include "Entry.h"
+#include "Notifier.h"
+#include "WorkQueue.h"
+#include "Worker.h"
+#include "Route.h"
+
+Route::Route(char const *prefix, NotifierRef notifier,
+	int workerCount, size_t queueLimit)
+{
+	this->prefix= prefix;
+	this->notifier= notifier;
+	this->workerCount= workerCount;
+
+	queue= WorkQueue::Create(queueLimit);
+}
+
+Route::~Route()
+{
+}
+
+bool Route::start()
+{
+	if (!notifier->start()) {
+		return false;
+	}
+
+	for (int i= 0; i < workerCount; i++) {
+		WorkerRef worker= std::make_shared<Worker>(queue, notifier);
+		workers.push_back(worker);
+		worker->start();
+	}
+
+	Log::log(LOG_DEBUG,
+		"Started %d notification worker threads for route \"%s\"",
+		workerCount, prefix.c_str());
+
+	return true;
+}
+
+void Route::stop()
+{
+	queue->stop();
+
+	while (!workers.empty()) {
+		WorkerRef worker= workers.front();
+		workers.pop_front();
+		worker->stop();
+	}
+
+	notifier->stop();
+}
+
+size_t Route::getQueued()
+{
+	return queue->size();
+}
+
+void Route::dispatch(EntryBatch const &batch)
+{
+	size_t dropped= queue->push(batch);
+	if (dropped > 0) {
+		Metrics::count(METRIC_NOTIFICATIONS_DROPPED, dropped);
+		LOG(LOG_ERROR,
+			"Queue for route \"%s\" is full - dropped %d notifications",
+			prefix.c_str(), (int)dropped);
+	}
+}
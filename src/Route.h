@@ -0,0 +1,49 @@
+class Worker;
+typedef std::shared_ptr<Worker> WorkerRef;
+
+class WorkQueue;
+typedef std::shared_ptr<WorkQueue> WorkQueueRef;
+
+/**
+ * Route
+ *
+ * Where notifications for a set of keys go: a notifier, with its own work
+ * queue and its own worker threads.  Since nothing is shared between
+ * routes, a flood of timeouts on one route can't hold up another.
+ */
+class Route {
+public:
+	Route(char const *prefix, NotifierRef notifier,
+		int workerCount, size_t queueLimit);
+	virtual ~Route();
+
+	bool start();
+	void stop();
+
+	// Queue expired entries for this route's workers
+	void dispatch(EntryBatch const &batch);
+
+	// Entries waiting for a worker
+	size_t getQueued();
+
+	char const *getPrefix() {
+		return prefix.c_str();
+	}
+
+	static std::shared_ptr<Route> Create(char const *prefix,
+		NotifierRef notifier, int workerCount, size_t queueLimit)
+	{
+		return std::make_shared<Route>(
+			prefix, notifier, workerCount, queueLimit);
+	}
+
+private:
+	std::string prefix;
+	NotifierRef notifier;
+	int workerCount;
+
+	WorkQueueRef queue;
+	std::list<WorkerRef> workers;
+};
+
+typedef std::shared_ptr<Route> RouteRef;
@@ -0,0 +1,248 @@
+#include "system.h"
+
+#include "Log.h"
+#include "Entry.h"
+#include "Notifier.h"
+#include "ScriptNotifier.h"
+#include "HelperNotifier.h"
+#include "plugin.h"
+#include "PluginNotifier.h"
+#include "HttpConnection.h"
+#include "WebhookNotifier.h"
+#include "CoalescingNotifier.h"
+#include "Route.h"
+#include "Router.h"
+
+Router::Router(RouteRef defaultRoute)
+{
+	routes.push_back(defaultRoute);
+}
+
+Router::~Router()
+{
+}
+
+NotifierRef Router::MakeNotifier(
+	char const *spec, RouteSettings const &settings)
+{
+	NotifierRef rval;
+
+	char const *colon= strchr(spec, ':');
+	if (colon == NULL) {
+		Log::log(LOG_ERROR, "Notifier should be type:target - %s", spec);
+		return rval;
+	}
+
+	std::string type(spec, colon - spec);
+	char const *target= colon + 1;
+
+	if (type == "script") {
+		rval= ScriptNotifier::Create(
+			target, settings.concurrency, settings.timeout);
+	} else if (type == "helper") {
+		rval= HelperNotifier::Create(target);
+	} else if (type == "plugin") {
+		rval= PluginNotifier::Create(target);
+	} else if (type == "webhook") {
+		rval= WebhookNotifier::Create(
+			target, settings.concurrency, settings.timeout);
+	} else {
+		Log::log(LOG_ERROR, "Unknown notifier type %s", type.c_str());
+	}
+
+	if (rval && (settings.coalesceWindow > 0)) {
+		rval= CoalescingNotifier::Create(rval, settings.coalesceWindow,
+			settings.coalesceGroupBy, settings.coalesceMinimum);
+	}
+
+	return rval;
+}
+
+bool Router::parseLine(char *line, RouteSettings const &defaults)
+{
+	char *save;
+	char *prefix= strtok_r(line, " \t", &save);
+	char *spec= strtok_r(NULL, " \t", &save);
+
+	if (spec == NULL) {
+		Log::log(LOG_ERROR, "Route for %s has no notifier", prefix);
+		return false;
+	}
+
+	RouteSettings settings= defaults;
+
+	char *option;
+	while ((option= strtok_r(NULL, " \t", &save)) != NULL) {
+		char *equals= strchr(option, '=');
+		if (equals == NULL) {
+			Log::log(LOG_ERROR, "Route option should be name=value - %s",
+				option);
+			return false;
+		}
+		*equals= '\0';
+
+		int value= atoi(equals + 1);
+		if (value < 0) {
+			Log::log(LOG_ERROR, "Invalid value for route option %s", option);
+			return false;
+		}
+
+		if (strcmp(option, "workers") == 0) {
+			settings.workers= value;
+		} else if (strcmp(option, "queue") == 0) {
+			settings.queueLimit= value;
+		} else if (strcmp(option, "concurrency") == 0) {
+			settings.concurrency= value;
+		} else if (strcmp(option, "timeout") == 0) {
+			settings.timeout= value;
+		} else if (strcmp(option, "coalesce") == 0) {
+			settings.coalesceWindow= value;
+		} else {
+			Log::log(LOG_ERROR, "Unknown route option %s", option);
+			return false;
+		}
+	}
+
+	if ((settings.workers < 1) || (settings.concurrency < 1)) {
+		Log::log(LOG_ERROR, "Route for %s needs at least one worker", prefix);
+		return false;
+	}
+
+	NotifierRef notifier= MakeNotifier(spec, settings);
+	if (!notifier) {
+		return false;
+	}
+
+	RouteRef route= Route::Create(
+		prefix, notifier, settings.workers, settings.queueLimit);
+
+	// Keep longer prefixes first so the first match is the longest.  The
+	// default route's prefix is empty so it stays at the end.
+	auto position= routes.begin();
+	while (strlen((*position)->getPrefix()) >= strlen(prefix)) {
+		if (strcmp((*position)->getPrefix(), prefix) == 0) {
+			Log::log(LOG_ERROR, "Duplicate route for %s", prefix);
+			return false;
+		}
+		++position;
+	}
+	routes.insert(position, route);
+
+	Log::log(LOG_DEBUG, "Routing %s* to %s", prefix, spec);
+	return true;
+}
+
+bool Router::load(char const *path, RouteSettings const &defaults)
+{
+	FILE *file= fopen(path, "rt");
+	if (file == NULL) {
+		Log::log(LOG_ERROR,
+			"Unable to read route file %s: %s",
+			path, strerror(errno));
+		return false;
+	}
+
+	bool rval= true;
+	int lineNumber= 0;
+
+	char line[1024];
+	while (rval && (fgets(line, sizeof(line), file) != NULL)) {
+		lineNumber++;
+
+		char *comment= strchr(line, '#');
+		if (comment != NULL) {
+			*comment= '\0';
+		}
+
+		for (char *c= &line[strlen(line) - 1];
+			(c >= line) && (*c <= ' '); c--) *c= '\0';
+
+		char *start= line;
+		while ((*start == ' ') || (*start == '\t')) {
+			start++;
+		}
+
+		if (*start != '\0') {
+			rval= parseLine(start, defaults);
+			if (!rval) {
+				Log::log(LOG_ERROR, "Error in route file %s line %d",
+					path, lineNumber);
+			}
+		}
+	}
+	fclose(file);
+
+	return rval;
+}
+
+bool Router::start()
+{
+	for (RouteRef route : routes) {
+		if (!route->start()) {
+			Log::log(LOG_ERROR, "Unable to start notifier for route \"%s\"",
+				route->getPrefix());
+			return false;
+		}
+	}
+	return true;
+}
+
+void Router::stop()
+{
+	for (RouteRef route : routes) {
+		route->stop();
+	}
+}
+
+Route *Router::find(char const *key)
+{
+	for (RouteRef const &route : routes) {
+		char const *prefix= route->getPrefix();
+		if (strncmp(key, prefix, strlen(prefix)) == 0) {
+			return route.get();
+		}
+	}
+
+	// Not reached since the default route matches everything
+	return routes.back().get();
+}
+
+void Router::dispatch(EntryBatch const &batch)
+{
+	// Usually everything is on one route
+	Route *first= batch.front()->getRoute();
+
+	bool mixed= false;
+	for (EntryRef const &entry : batch) {
+		if (entry->getRoute() != first) {
+			mixed= true;
+			break;
+		}
+	}
+
+	if (!mixed) {
+		if (first != NULL) {
+			first->dispatch(batch);
+		}
+		return;
+	}
+
+	std::map<Route *, EntryBatch> byRoute;
+	for (EntryRef const &entry : batch) {
+		if (entry->getRoute() != NULL) {
+			byRoute[entry->getRoute()].push_back(entry);
+		}
+	}
+	for (auto const &routeBatch : byRoute) {
+		routeBatch.first->dispatch(routeBatch.second);
+	}
+}
+
+size_t Router::getQueued()
+{
+	size_t queued= 0;
+	for (RouteRef const &route : routes) {
+		queued+= route->getQueued();
+	}
+	return queued;
+}
@@ -0,0 +1,69 @@
+class Route;
+typedef std::shared_ptr<Route> RouteRef;
+
+// Settings for a route that the route file doesn't override, which come
+// from the command line.
+struct RouteSettings {
+	int workers;
+	size_t queueLimit;
+
+	// Concurrency and time limit for scripts and webhooks
+	int concurrency;
+	int timeout;
+
+	// A window of zero turns coalescing off
+	int coalesceWindow;
+	CoalescingNotifier::GroupBy coalesceGroupBy;
+	int coalesceMinimum;
+};
+
+/**
+ * Router
+ *
+ * Picks the route for each key.  The route with the longest prefix that
+ * matches the key wins, and anything that doesn't match a route goes to
+ * the default route.  This is decided once when an entry is created and
+ * cached in the entry, so at expiry time there's nothing to look up.
+ *
+ * Extra routes are read from a file with a line per route:
+ *
+ *     prefix  notifier  [option=value ...]
+ *
+ * The notifier is script:path, helper:path, plugin:path[,argument] or
+ * webhook:url, and the options are workers, queue, concurrency, timeout
+ * and coalesce.  Anything after a '#' is a comment.
+ */
+class Router {
+public:
+	Router(RouteRef defaultRoute);
+	virtual ~Router();
+
+	bool load(char const *path, RouteSettings const &defaults);
+
+	bool start();
+	void stop();
+
+	Route *find(char const *key);
+
+	// Hand expired entries to their routes
+	void dispatch(EntryBatch const &batch);
+
+	// Entries waiting for a worker across all routes
+	size_t getQueued();
+
+	static std::shared_ptr<Router> Create(RouteRef defaultRoute) {
+		return std::make_shared<Router>(defaultRoute);
+	}
+
+	// Build a notifier from a route file spec
+	static NotifierRef MakeNotifier(
+		char const *spec, RouteSettings const &settings);
+
+private:
+	// Longest prefix first, with the default route last
+	std::vector<RouteRef> routes;
+
+	bool parseLine(char *line, RouteSettings const &defaults);
+};
+
+typedef std::shared_ptr<Router> RouterRef;
@@ -1,31 +1,96 @@
 #include "system.h"
 
 #include "Log.h"
+#include "Metrics.h"
+#include "probes.h"
+#include "Clock.h"
 #include "Entry.h"
-#include "Worker.h"
+#include "Notifier.h"
+#include "CoalescingNotifier.h"
+#include "Route.h"
+#include "Router.h"
+#include "EventServer.h"
+#include "Receiver.h"
 #include "Scheduler.h"
 
-// #define DEBUG_RECEIVED
-// #define DEBUG_SCHEDLOOP
-
 Scheduler::Scheduler(int entryLimit)
 {
 	this->entryLimit= entryLimit;
 	entryCount= 0;
+
+	lazyRescheduling= true;
+	indexOperations= 0;
+
+	clock= MonotonicClock::Create();
 }
 
 Scheduler::~Scheduler()
 {
 }
 
-void Scheduler::receive(char const *key, int timeout, char const *address)
+void Scheduler::receive(
+	char const *key, char const *lease, int timeout, char const *address)
 {
 	struct timeval expires;
-	gettimeofday(&expires, NULL);
+	clock->now(&expires);
 	expires.tv_sec+= timeout;
 
 	std::lock_guard<std::mutex> lock(mutex);
 
+	// The scheduling thread only cares if the head of the index moves
+	// earlier, which a plain refresh never does.  Skipping the wakeup
+	// saves it from taking the lock just to go back to sleep.
+	Entry *oldHead= NULL;
+	struct timeval oldHeadExpires;
+	if (!byTimeout.empty()) {
+		oldHead= byTimeout.begin()->get();
+		oldHeadExpires= *oldHead->getExpires();
+	}
+
+	if (lease == NULL) {
+		receiveKey(key, timeout, expires, address);
+	} else {
+		receiveLease(key, lease, timeout, expires, address);
+	}
+
+	if (!byTimeout.empty()) {
+		Entry *newHead= byTimeout.begin()->get();
+		if ((newHead != oldHead) ||
+			timercmp(newHead->getExpires(), &oldHeadExpires, <))
+		{
+			scheduleWake.notify_one();
+		}
+	}
+}
+
+void Scheduler::defer(
+	EntryRef entry, struct timeval& deadline, char const *address)
+{
+	// While the entry is on the byTimeout structure, the expires
+	// time must be invariant or the structure becomes logically
+	// inconsistent, causing some rather strange failures.
+	//
+	// If the new deadline is later than where the entry already sits,
+	// which is almost always the case, lazy rescheduling just records
+	// the deadline and leaves the index alone.  Otherwise we have to
+	// erase the entry from the timeout structure before moving it.
+
+	if (lazyRescheduling &&
+		!timercmp(&deadline, entry->getExpires(), <))
+	{
+		entry->receive(deadline, address);
+	} else {
+		indexErase(entry);
+		entry->receive(deadline, address);
+		entry->reschedule();
+		indexInsert(entry);
+	}
+}
+
+void Scheduler::receiveKey(
+	char const *key, int timeout, struct timeval& expires,
+	char const *address)
+{
 	auto keyIter= byKey.find(key);
 	EntryRef entry;
 
@@ -34,73 +99,192 @@ void Scheduler::receive(char const *key, int timeout, char const *address)
 		// stop monitoring without notification.
 
 		if (keyIter != byKey.end()) {
+			entry= keyIter->second;
 			byKey.erase(keyIter);
 			entryCount--;
 
-			entry= keyIter->second;
-			byTimeout.erase(entry);
+			if (entry->getLease() != NULL) {
+				entry->getLease()->detach(entry);
+			} else {
+				indexErase(entry);
+			}
 
-			Log::log(LOG_INFO,
+			LOG(LOG_INFO,
 				"Volutary removal of key %s",
 				key);
+			PROBE2(key__remove, entry->getKey(), address);
+
+			if (events) {
+				events->publish(EventServer::REMOVE, entry);
+			}
 		}
 	} else {
 		if (keyIter == byKey.end()) {
-			if (entryCount >= entryLimit) {
-				Log::log(LOG_WARNING,
-					"Cannot add entry - entry count %d is at quota",
-					entryLimit);
+			entry= createEntry(key, expires, address);
+			if (entry) {
+				indexInsert(entry);
+
+				LOG(LOG_TRACE, "Create %s:%d", key, timeout);
+				PROBE3(key__create, entry->getKey(), address, timeout);
+			}
+		} else {
+			entry= keyIter->second;
 
+			// If the entry was attached to a lease, the sender has gone
+			// back to refreshing it on its own, so it goes back on the
+			// index.
+
+			if (entry->getLease() != NULL) {
+				entry->getLease()->detach(entry);
+				entry->receive(expires, address);
+				entry->reschedule();
+				indexInsert(entry);
 			} else {
-				entry= std::make_shared<Entry>(key, expires, address);
-				byKey.insert(
-					std::pair<char const *, EntryRef>(entry->getKey(), entry));
-				entryCount++;
+				defer(entry, expires, address);
+			}
+
+			LOG(LOG_TRACE, "Defer %s:%d", key, timeout);
+			PROBE3(key__defer, entry->getKey(), address, timeout);
+		}
+	}
+}
+
+void Scheduler::receiveLease(
+	char const *key, char const *lease, int timeout,
+	struct timeval& expires, char const *address)
+{
+	std::string leaseKey= "@";
+	leaseKey.append(lease);
+
+	auto leaseIter= byKey.find(leaseKey.c_str());
+
+	if (timeout <= 0) {
+		if (*key != '\0') {
+			receiveKey(key, timeout, expires, address);
+		} else if (leaseIter != byKey.end()) {
+			// Dropping the lease drops everything attached to it, again
+			// without notification.
+
+			EntryRef leaseEntry= leaseIter->second;
+			byKey.erase(leaseIter);
+			indexErase(leaseEntry);
+			entryCount--;
+
+			std::list<EntryRef>& attached= leaseEntry->getAttached();
+			int attachedCount= attached.size();
+
+			while (!attached.empty()) {
+				EntryRef entry= attached.front();
+				leaseEntry->detach(entry);
 
-				byTimeout.insert(entry);
+				byKey.erase(entry->getKey());
+				entryCount--;
 
-#ifdef DEBUG_RECEIVED
-				Log::log(LOG_DEBUG, "Create %s:%d", key, timeout);
-#endif
+				PROBE2(key__remove, entry->getKey(), address);
+				if (events) {
+					events->publish(EventServer::REMOVE, entry);
+				}
 			}
+
+			PROBE2(key__remove, leaseEntry->getKey(), address);
+			LOG(LOG_INFO,
+				"Volutary removal of lease %s with %d keys",
+				lease, attachedCount);
+		}
+	} else {
+		EntryRef leaseEntry;
+
+		if (leaseIter == byKey.end()) {
+			leaseEntry= createEntry(leaseKey.c_str(), expires, address);
+			if (!leaseEntry) {
+				return;
+			}
+			indexInsert(leaseEntry);
+
+			LOG(LOG_TRACE, "Create lease %s:%d", lease, timeout);
+			PROBE3(key__create, leaseEntry->getKey(), address, timeout);
 		} else {
-			entry= keyIter->second;
+			leaseEntry= leaseIter->second;
+			defer(leaseEntry, expires, address);
+
+			LOG(LOG_TRACE, "Defer lease %s:%d", lease, timeout);
+			PROBE3(key__defer, leaseEntry->getKey(), address, timeout);
+		}
 
-			// While the entry is on the byTimeout structure, the expires
-			// time must be invariant or the structure becomes logically
-			// inconsistent, causing some rather strange failures.
-			//
-			// So we have to erase the entry from the timeout structure
-			// before calling receive() which modifies it.
+		if (*key != '\0') {
+			// Attach the key to the lease if it isn't already.  The
+			// expire time on an attached entry isn't used, but we keep
+			// it current anyway.
 
-			byTimeout.erase(entry);
-			entry->receive(expires, address);
-			byTimeout.insert(entry);
+			auto keyIter= byKey.find(key);
+			EntryRef entry;
 
-#ifdef DEBUG_RECEIVED
-			Log::log(LOG_DEBUG, "Defer %s:%d", key, timeout);
-#endif
+			if (keyIter == byKey.end()) {
+				entry= createEntry(key, expires, address);
+				if (entry) {
+					leaseEntry->attach(entry);
+				}
+			} else {
+				entry= keyIter->second;
+
+				Entry *oldLease= entry->getLease();
+				if (oldLease == NULL) {
+					indexErase(entry);
+					entry->receive(expires, address);
+					leaseEntry->attach(entry);
+				} else if (oldLease != leaseEntry.get()) {
+					oldLease->detach(entry);
+					entry->receive(expires, address);
+					leaseEntry->attach(entry);
+				} else {
+					entry->receive(expires, address);
+				}
+			}
 		}
 	}
+}
 
-	scheduleWake.notify_one();
+void Scheduler::indexInsert(EntryRef entry)
+{
+	byTimeout.insert(entry);
+	indexOperations++;
 }
 
-void Scheduler::start()
+void Scheduler::indexErase(EntryRef entry)
 {
-	run= true;
-	thread= new std::thread(&Scheduler::scheduleLoop, this);
+	byTimeout.erase(entry);
+	indexOperations++;
+}
+
+EntryRef Scheduler::createEntry(
+	char const *key, struct timeval& expires, char const *address)
+{
+	EntryRef entry;
 
-	int numWorkers= 4;
+	if (entryCount >= entryLimit) {
+		LOG_REPEATED(LOG_WARNING, address,
+			"Cannot add entry from %s - entry count %d is at quota",
+			address, entryLimit);
+		Metrics::count(METRIC_QUOTA_REJECTIONS);
+		PROBE2(key__reject, key, address);
+	} else {
+		entry= std::make_shared<Entry>(key, expires, address);
+		if (router) {
+			entry->setRoute(router->find(entry->getKey()));
+		}
 
-	for (int i= 0; i < numWorkers; i++) {
-		WorkerRef w= std::make_shared<Worker>(this);
-		workerList.push_back(w);
-		w->start();
+		byKey.insert(
+			std::pair<char const *, EntryRef>(entry->getKey(), entry));
+		entryCount++;
 	}
 
-	Log::log(LOG_DEBUG,
-		"Started %d notification worker threads", numWorkers);
+	return entry;
+}
+
+void Scheduler::start()
+{
+	run= true;
+	thread= new std::thread(&Scheduler::scheduleLoop, this);
 }
 
 void Scheduler::stop()
@@ -109,95 +293,135 @@ void Scheduler::stop()
 	scheduleWake.notify_one();
 	thread->join();
 	delete thread;
+}
 
-	for (WorkerRef worker : workerList) {
-		worker->stop1();
+bool Scheduler::expireHead(struct timeval const &now, EntryBatch& expired)
+{
+	if (byTimeout.empty()) {
+		return false;
 	}
 
-	workerWake.notify_all();
+	auto startIter= byTimeout.begin();
+	EntryRef entry= *startIter;
 
-	while (!workerList.empty()) {
-		WorkerRef worker= workerList.front();
-		workerList.pop_front();
-		worker->stop2();
+	LOG(LOG_TRACE, "Head of Line: %s",
+		entry->getKey());
+
+	const struct timeval *nextRun= entry->getExpires();
+	if (timercmp(nextRun, &now, >)) {
+		return false;
 	}
-}
 
-EntryRef Scheduler::getWork()
-{
-	EntryRef rval;
-	std::unique_lock<std::mutex> lock(mutex);
+	if (entry->isStale()) {
+		// The entry was refreshed after it went on the index, so move it
+		// to where it really belongs instead of firing it.
 
-	while (run && workerQueue.empty()) {
-		workerWake.wait(lock);
+		LOG(LOG_TRACE, "Requeue %s", entry->getKey());
+
+		byTimeout.erase(startIter);
+		indexOperations++;
+
+		entry->reschedule();
+		indexInsert(entry);
+		return true;
 	}
-	if (run) {
-		rval= workerQueue.front();
-		workerQueue.pop_front();
+
+	int64_t lateness=
+		(int64_t)(now.tv_sec - nextRun->tv_sec) * 1000000000LL +
+		(int64_t)(now.tv_usec - nextRun->tv_usec) * 1000;
+
+	Metrics::record(HIST_EXPIRY_LATENESS, lateness);
+	PROBE3(key__expire, entry->getKey(),
+		entry->getLastAddress(), lateness);
+
+	byTimeout.erase(startIter);
+	indexOperations++;
+
+	auto keyIter= byKey.find(entry->getKey());
+	assert(keyIter != byKey.end());
+
+	LOG(LOG_TRACE, "Removing %s", entry->getKey());
+
+	byKey.erase(keyIter);
+	entryCount--;
+
+	if (entry->isLease()) {
+		// Everything attached to the lease expires with it
+		std::list<EntryRef>& attached= entry->getAttached();
+
+		while (!attached.empty()) {
+			EntryRef child= attached.front();
+			entry->detach(child);
+
+			byKey.erase(child->getKey());
+			entryCount--;
+
+			PROBE3(key__expire, child->getKey(),
+				child->getLastAddress(), lateness);
+			expired.push_back(child);
+		}
+	} else {
+		expired.push_back(entry);
 	}
 
-	return rval;
+	return true;
+}
+
+void Scheduler::expireDue(EntryBatch& expired)
+{
+	struct timeval now;
+	clock->now(&now);
+
+	std::lock_guard<std::mutex> lock(mutex);
+	while (expireHead(now, expired)) {
+	}
 }
 
 void Scheduler::scheduleLoop()
 {
 	bool localRun= run;
+	EntryBatch expired;
+
 	while (localRun) {
 		struct timeval now;
-		gettimeofday(&now, NULL);
+		clock->now(&now);
+
+		// Everything that expires together goes to the workers in one
+		// push, made without holding our lock.  That happens once nothing
+		// else is due, or sooner if a lot is expiring at once.
+		bool handOff= false;
 
 		std::unique_lock<std::mutex> lock(mutex);
-		if (!byTimeout.empty()) {
-			auto startIter= byTimeout.begin();
-			EntryRef entry= *startIter;
-
-#ifdef DEBUG_SCHEDLOOP
-			Log::log(LOG_DEBUG, "Head of Line: %s",
-				entry->getKey());
-#endif
-
-			const struct timeval *nextRun= entry->getExpires();
-			if ((nextRun->tv_sec < now.tv_sec) ||
-				((nextRun->tv_sec == now.tv_sec) &&
-				(nextRun->tv_usec <= now.tv_usec)))
-			{
-				byTimeout.erase(startIter);
-
-				auto keyIter= byKey.find(entry->getKey());
-				assert(keyIter != byKey.end());
-
-#ifdef DEBUG_SCHEDLOOP
-				Log::log(LOG_DEBUG, "Removing %s", entry->getKey());
-#endif
-
-				byKey.erase(keyIter);
-				entryCount--;
+		if (expireHead(now, expired)) {
+			handOff= (expired.size() >= MAX_WORK_BATCH);
+		} else if (!expired.empty()) {
+			handOff= true;
+		} else if (!byTimeout.empty()) {
+			const struct timeval *nextRun= (*byTimeout.begin())->getExpires();
 
-				workerQueue.push_back(entry);
-				workerWake.notify_one();
-			} else {
-				entry= nullptr;
-
-				auto d= std::chrono::seconds(nextRun->tv_sec) +
-					std::chrono::microseconds(nextRun->tv_usec);
-				std::chrono::system_clock::time_point wake{
-					std::chrono::duration_cast<
-					std::chrono::system_clock::duration>(d)};
-
-#ifdef DEBUG_SCHEDLOOP
-				Log::log(LOG_DEBUG, "Scheduler - wait about %d sec",
-					nextRun->tv_sec - now.tv_sec);
-#endif
-				scheduleWake.wait_until(lock, wake);
-			}
+			LOG(LOG_TRACE, "Scheduler - wait about %ld sec",
+				(long)(nextRun->tv_sec - now.tv_sec));
+
+			clock->wait(lock, scheduleWake, nextRun);
 		} else {
-#ifdef DEBUG_SCHEDLOOP
-			Log::log(LOG_DEBUG, "Scheduler - indefinite wait");
-#endif
-			scheduleWake.wait(lock);
+			LOG(LOG_TRACE, "Scheduler - indefinite wait");
+
+			clock->wait(lock, scheduleWake, NULL);
 		}
 
 		localRun= run;
+		lock.unlock();
+
+		if (handOff) {
+			Metrics::count(METRIC_ENTRIES_EXPIRED, expired.size());
+
+			if (events) {
+				events->publish(EventServer::EXPIRE, expired);
+			}
+			if (router) {
+				router->dispatch(expired);
+			}
+			expired.clear();
+		}
 	}
 }
-
@@ -1,8 +1,15 @@
 class Entry;
 typedef std::shared_ptr<Entry> EntryRef;
+typedef std::vector<EntryRef> EntryBatch;
 
-class Worker;
-typedef std::shared_ptr<Worker> WorkerRef;
+class Router;
+typedef std::shared_ptr<Router> RouterRef;
+
+class EventServer;
+typedef std::shared_ptr<EventServer> EventServerRef;
+
+class Clock;
+typedef std::shared_ptr<Clock> ClockRef;
 
 // "less" comparator based on string comparison of char const *
 struct CompareConstChar {
@@ -17,19 +24,62 @@ struct CompareConstChar {
  * The scheduler keeps track of the database of entries, and continuously
  * loops on the one with the earliest timeout.  If an entry expires, the
  * scheduler removes the key and schedules it on a work queue for notification.
+ *
+ * Keys can also be attached to a lease, in which case refreshing the lease
+ * defers all of them at once, and the lease expiring notifies all of them.
  */
-class Scheduler {
+class Scheduler : public Receiver {
 public:
 	Scheduler(int entryLimit);
 	virtual ~Scheduler();
 
-	void receive(char const *key, int timeout, char const *address);
+	virtual void receive(char const *key, char const *lease,
+		int timeout, char const *address);
 
 	void start();
 	void stop();
 
-	// Called by worker threads to get new work items
-	EntryRef getWork();
+	// Set where expired entries go.  This has to be called before any
+	// entries are created, since each entry's route is picked then.
+	void setRouter(RouterRef router) {
+		this->router= router;
+	}
+
+	// Optionally publish timeouts and voluntary removals to subscribers
+	void setEventServer(EventServerRef events) {
+		this->events= events;
+	}
+
+	// Replace the monotonic clock, normally with a VirtualClock.  Like the
+	// router this has to be set before any entries are created.
+	void setClock(ClockRef clock) {
+		this->clock= clock;
+	}
+
+	// Without the scheduling thread, expire everything that's due by the
+	// clock's current time, adding it to expired in deadline order.
+	// Nothing is dispatched or published.  This is for driving the
+	// scheduler from a VirtualClock.
+	void expireDue(EntryBatch& expired);
+
+	// With lazy rescheduling, which is the default, a refresh only
+	// records the new deadline on the entry, and the timeout index is
+	// corrected when the scheduling thread reaches the old position.
+	void setLazyRescheduling(bool lazyRescheduling) {
+		this->lazyRescheduling= lazyRescheduling;
+	}
+
+	// Number of keys and leases being monitored
+	int getEntryCount() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return entryCount;
+	}
+
+	// Number of inserts and erases done on the timeout index
+	unsigned long getIndexOperations() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return indexOperations;
+	}
 
 
 	static std::shared_ptr<Scheduler> Create(int entryLimit) {
@@ -37,6 +87,27 @@ public:
 	}
 
 private:
+	void receiveKey(char const *key, int timeout,
+		struct timeval& expires, char const *address);
+	void receiveLease(char const *key, char const *lease, int timeout,
+		struct timeval& expires, char const *address);
+
+	// Move an entry already on the index to a new deadline
+	void defer(EntryRef entry, struct timeval& deadline, char const *address);
+
+	void indexInsert(EntryRef entry);
+	void indexErase(EntryRef entry);
+
+	// If the head of the index is due by now, either move it to its real
+	// deadline or expire it onto expired.  Returns false if nothing was
+	// due.  Called with the lock held.
+	bool expireHead(struct timeval const &now, EntryBatch& expired);
+
+	// Create an entry and add it to byKey, or return an empty reference if
+	// we're at the limit.  Adding it to byTimeout is up to the caller.
+	EntryRef createEntry(
+		char const *key, struct timeval& expires, char const *address);
+
 	// We're using a map for key->entry, but to avoid burning memory to
 	// store a superfluous copy of an invariant key, we just use a raw
 	// "char const *" as the key type.
@@ -59,23 +130,23 @@ private:
 	int entryCount;
 	int entryLimit;
 
+	bool lazyRescheduling;
+	unsigned long indexOperations;
+
 	// Lock for everything
 	std::mutex mutex;
 
 	// Indicator to keep running
 	volatile bool run;
 
-	// There's a set of workers that do the actual notifications, and the
-	// scheduling thread keeps processing without blocking.
-
-	// List of entries waiting on a worker
-	std::list<EntryRef> workerQueue;
+	// Each route has a set of workers that do the actual notifications,
+	// and the scheduling thread keeps processing without blocking.  The
+	// routes' queues have their own locks, so the workers never touch ours.
+	RouterRef router;
 
-	// Condition signalling available work
-	std::condition_variable workerWake;
+	EventServerRef events;
 
-	// List of workers
-	std::list<WorkerRef> workerList;
+	ClockRef clock;
 
 	// Main schedule loop
 	void scheduleLoop();
@@ -0,0 +1,441 @@
+#include "system.h"
+
+#include "Log.h"
+#include "Metrics.h"
+#include "probes.h"
+#include "Entry.h"
+#include "Notifier.h"
+#include "ScriptNotifier.h"
+
+// Most entries we'll hold waiting for a free slot.  Past this something is
+// badly wrong, and piling up more just makes it take longer to recover.
+#define MAX_QUEUED 10000
+
+// How often to check on children if we can't get a pidfd for them
+#define POLL_INTERVAL_MS 100
+
+#define MAX_EVENTS 16
+
+// Everything about launching the notify script except the arguments is the
+// same every time, so it's built once.  posix_spawn only reads these, so
+// they can be shared between threads.
+
+static std::once_flag spawnSetupOnce;
+static std::vector<char *> spawnEnvironment;
+static posix_spawnattr_t spawnAttributes;
+static posix_spawn_file_actions_t spawnFileActions;
+
+static void spawnSetup()
+{
+	for (char **env= environ; *env != NULL; env++) {
+		spawnEnvironment.push_back(*env);
+	}
+	spawnEnvironment.push_back(NULL);
+
+	// We ignore SIGPIPE and block nothing, but the script shouldn't
+	// inherit either way.
+	sigset_t defaultSignals;
+	sigemptyset(&defaultSignals);
+	sigaddset(&defaultSignals, SIGPIPE);
+
+	sigset_t noSignals;
+	sigemptyset(&noSignals);
+
+	// Each script gets its own process group, so if it hangs we can kill
+	// whatever it started along with it.
+	posix_spawnattr_init(&spawnAttributes);
+	posix_spawnattr_setsigdefault(&spawnAttributes, &defaultSignals);
+	posix_spawnattr_setsigmask(&spawnAttributes, &noSignals);
+	posix_spawnattr_setpgroup(&spawnAttributes, 0);
+	posix_spawnattr_setflags(&spawnAttributes,
+		POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_SETSIGMASK |
+		POSIX_SPAWN_SETPGROUP);
+
+	// Our own descriptors are all close-on-exec, but this also catches
+	// anything a library opened without it.
+	posix_spawn_file_actions_init(&spawnFileActions);
+#ifdef HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCLOSEFROM_NP
+	posix_spawn_file_actions_addclosefrom_np(&spawnFileActions, 3);
+#endif
+}
+
+static int pidfdOpen(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+	return syscall(SYS_pidfd_open, pid, 0);
+#else
+	errno= ENOSYS;
+	return -1;
+#endif
+}
+
+static void monotonicNow(struct timespec *now)
+{
+	clock_gettime(CLOCK_MONOTONIC, now);
+}
+
+ScriptNotifier::ScriptNotifier(
+	char const *script, int maxRunning, int timeout)
+{
+	this->script= script;
+	this->maxRunning= maxRunning;
+	this->timeout= timeout;
+
+	epollFd= -1;
+	wakeFd= -1;
+	thread= NULL;
+}
+
+ScriptNotifier::~ScriptNotifier()
+{
+}
+
+std::string ScriptNotifier::Describe(EntryBatch const &group)
+{
+	std::string rval;
+	if (!group.empty()) {
+		rval= group.front()->getKey();
+		if (group.size() > 1) {
+			rval.append(" and " + std::to_string(group.size() - 1) + " more");
+		}
+	}
+	return rval;
+}
+
+int ScriptNotifier::Spawn(char const *argv[], pid_t *childPid, int stdinFd)
+{
+	std::call_once(spawnSetupOnce, spawnSetup);
+
+	// Unlike fork(), posix_spawn doesn't copy our page tables - glibc
+	// uses clone(CLONE_VM|CLONE_VFORK) - so the cost doesn't grow with
+	// the size of the entry database.
+
+	if (stdinFd == -1) {
+		return posix_spawn(childPid, argv[0],
+			&spawnFileActions, &spawnAttributes,
+			(char **)argv, spawnEnvironment.data());
+	}
+
+	// The dup2 also clears close-on-exec on the new descriptor
+	posix_spawn_file_actions_t fileActions;
+	posix_spawn_file_actions_init(&fileActions);
+	posix_spawn_file_actions_adddup2(&fileActions, stdinFd, 0);
+#ifdef HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCLOSEFROM_NP
+	posix_spawn_file_actions_addclosefrom_np(&fileActions, 3);
+#endif
+
+	int rval= posix_spawn(childPid, argv[0],
+		&fileActions, &spawnAttributes,
+		(char **)argv, spawnEnvironment.data());
+
+	posix_spawn_file_actions_destroy(&fileActions);
+	return rval;
+}
+
+bool ScriptNotifier::start()
+{
+	epollFd= epoll_create1(EPOLL_CLOEXEC);
+	if (epollFd == -1) {
+		Log::log(LOG_ERROR,
+			"Unable to create notifier epoll set: %s",
+			strerror(errno));
+		return false;
+	}
+
+	wakeFd= eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (wakeFd == -1) {
+		Log::log(LOG_ERROR,
+			"Unable to create notifier wake descriptor: %s",
+			strerror(errno));
+		close(epollFd);
+		return false;
+	}
+
+	struct epoll_event event;
+	event.events= EPOLLIN;
+	event.data.ptr= NULL;
+	epoll_ctl(epollFd, EPOLL_CTL_ADD, wakeFd, &event);
+
+	run= true;
+	thread= new std::thread(&ScriptNotifier::loop, this);
+
+	Log::log(LOG_DEBUG,
+		"Running up to %d notification scripts at once", maxRunning);
+
+	return true;
+}
+
+void ScriptNotifier::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		run= false;
+	}
+
+	uint64_t one= 1;
+	if (write(wakeFd, &one, sizeof(one)) == -1) {
+		Log::log(LOG_ERROR,
+			"Error waking notifier: %s",
+			strerror(errno));
+	}
+
+	thread->join();
+	delete thread;
+	thread= NULL;
+
+	close(wakeFd);
+	close(epollFd);
+}
+
+void ScriptNotifier::notify(EntryRef entry)
+{
+	notifyGroup(EntryBatch(1, entry));
+}
+
+void ScriptNotifier::notifyGroup(EntryBatch const &group)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (queue.size() >= MAX_QUEUED) {
+			Log::log(LOG_ERROR,
+				"Notification queue is full - dropping notification for %s",
+				Describe(group).c_str());
+			return;
+		}
+		queue.push_back(group);
+	}
+
+	uint64_t one= 1;
+	if (write(wakeFd, &one, sizeof(one)) == -1) {
+		Log::log(LOG_ERROR,
+			"Error waking notifier: %s",
+			strerror(errno));
+	}
+}
+
+void ScriptNotifier::launch(EntryBatch const &group)
+{
+	// The key and address of each entry, in pairs
+	std::vector<char const *> childArgv;
+	childArgv.reserve(group.size() * 2 + 2);
+
+	childArgv.push_back(script.c_str());
+	for (EntryRef const &entry : group) {
+		childArgv.push_back(entry->getKey());
+		childArgv.push_back(entry->getLastAddress());
+	}
+	childArgv.push_back(NULL);
+
+	pid_t childPid;
+	int spawnRval= Spawn(childArgv.data(), &childPid);
+	if (spawnRval != 0) {
+		Log::log(LOG_ERROR, "Failed to launch notify script %s: %s",
+			childArgv[0], strerror(spawnRval));
+		return;
+	}
+
+	Child child;
+	child.pid= childPid;
+	child.group= group;
+	child.killed= false;
+	child.started= Metrics::now();
+
+	monotonicNow(&child.deadline);
+	child.deadline.tv_sec+= timeout;
+
+	child.pidfd= pidfdOpen(childPid);
+	if (child.pidfd == -1) {
+		Log::log(LOG_DEBUG,
+			"No pidfd for notification script (%s), polling instead",
+			strerror(errno));
+	}
+
+	running.push_back(child);
+
+	if (child.pidfd != -1) {
+		struct epoll_event event;
+		event.events= EPOLLIN;
+		event.data.ptr= &running.back();
+
+		if (epoll_ctl(epollFd, EPOLL_CTL_ADD, child.pidfd, &event) == -1) {
+			Log::log(LOG_ERROR,
+				"Unable to watch notification script: %s",
+				strerror(errno));
+			close(child.pidfd);
+			running.back().pidfd= -1;
+		}
+	}
+}
+
+void ScriptNotifier::reap(std::list<Child>::iterator child, bool block)
+{
+	int status;
+	pid_t waitRval;
+	do {
+		waitRval= waitpid(child->pid, &status, block ? 0 : WNOHANG);
+	} while ((waitRval == -1) && (errno == EINTR));
+
+	if (waitRval == 0) {
+		// Still running
+		return;
+	}
+
+	if (waitRval != -1) {
+		int64_t duration= Metrics::now() - child->started;
+
+		Metrics::record(HIST_NOTIFY, duration);
+		PROBE4(script__done, child->group.front()->getKey(),
+			child->pid, status, duration);
+	}
+
+	if (waitRval == -1) {
+		Log::log(LOG_ERROR,
+			"Error waiting for notification script: %s",
+			strerror(errno));
+	} else if (WIFEXITED(status)) {
+		if (WEXITSTATUS(status) != 0) {
+			Log::log(LOG_WARNING,
+				"Notification script for %s exited with status %d",
+				Describe(child->group).c_str(), WEXITSTATUS(status));
+		} else {
+			Log::log(LOG_DEBUG,
+				"Notification script for %s completed",
+				Describe(child->group).c_str());
+		}
+	} else if (WIFSIGNALED(status)) {
+		Log::log(LOG_WARNING,
+			"Notification script for %s exited on signal %d",
+			Describe(child->group).c_str(), WTERMSIG(status));
+	}
+
+	if (child->pidfd != -1) {
+		epoll_ctl(epollFd, EPOLL_CTL_DEL, child->pidfd, NULL);
+		close(child->pidfd);
+	}
+
+	running.erase(child);
+}
+
+int ScriptNotifier::nextTimeout()
+{
+	int rval= -1;
+
+	struct timespec now;
+	monotonicNow(&now);
+
+	for (Child const &child : running) {
+		int childTimeout;
+
+		if (child.pidfd == -1) {
+			childTimeout= POLL_INTERVAL_MS;
+		} else if ((timeout > 0) && !child.killed) {
+			// Round up so we don't wake just short of the deadline
+			long ns= (child.deadline.tv_sec - now.tv_sec) * 1000000000L +
+				(child.deadline.tv_nsec - now.tv_nsec);
+			childTimeout= (ns < 0) ? 0 : (int)((ns + 999999) / 1000000);
+		} else {
+			continue;
+		}
+
+		if ((rval == -1) || (childTimeout < rval)) {
+			rval= childTimeout;
+		}
+	}
+
+	return rval;
+}
+
+void ScriptNotifier::loop()
+{
+	for (;;) {
+		bool localRun;
+		std::list<EntryBatch> launchable;
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			localRun= run;
+
+			if (localRun) {
+				while (!queue.empty() &&
+					((int)(running.size() + launchable.size()) < maxRunning))
+				{
+					launchable.push_back(queue.front());
+					queue.pop_front();
+				}
+			} else if (!queue.empty()) {
+				Log::log(LOG_WARNING,
+					"Discarding %d queued notifications at shutdown",
+					(int)queue.size());
+				queue.clear();
+			}
+		}
+
+		for (EntryBatch const &group : launchable) {
+			launch(group);
+		}
+
+		// When stopping we still wait for running scripts to finish or
+		// time out, so they don't get left as zombies.
+		if (!localRun && running.empty()) {
+			break;
+		}
+
+		struct epoll_event events[MAX_EVENTS];
+		int eventCount= epoll_wait(epollFd,
+			events, MAX_EVENTS, nextTimeout());
+
+		if (eventCount == -1) {
+			if (errno != EINTR) {
+				Log::log(LOG_ERROR,
+					"Error waiting for notification scripts: %s",
+					strerror(errno));
+				sleep(1);
+			}
+			continue;
+		}
+
+		for (int i= 0; i < eventCount; i++) {
+			if (events[i].data.ptr == NULL) {
+				uint64_t junk;
+				if (read(wakeFd, &junk, sizeof(junk)) == -1) {
+					// Non-blocking, so this is just a spurious wake
+				}
+			} else {
+				Child *ready= static_cast<Child *>(events[i].data.ptr);
+				for (auto child= running.begin();
+					child != running.end(); ++child)
+				{
+					if (&*child == ready) {
+						reap(child, true);
+						break;
+					}
+				}
+			}
+		}
+
+		// Kill anything that has run too long, and check on anything we
+		// couldn't get a pidfd for.
+		struct timespec now;
+		monotonicNow(&now);
+
+		for (auto child= running.begin(); child != running.end(); ) {
+			auto current= child++;
+
+			if ((timeout > 0) && !current->killed &&
+				((now.tv_sec > current->deadline.tv_sec) ||
+				((now.tv_sec == current->deadline.tv_sec) &&
+				(now.tv_nsec >= current->deadline.tv_nsec))))
+			{
+				Log::log(LOG_WARNING,
+					"Notification script for %s ran over %d seconds",
+					Describe(current->group).c_str(), timeout);
+
+				kill(-current->pid, SIGKILL);
+				current->killed= true;
+			}
+
+			if (current->pidfd == -1) {
+				reap(current, false);
+			}
+		}
+	}
+}
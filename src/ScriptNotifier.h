@@ -0,0 +1,83 @@
+
+/**
+ * ScriptNotifier
+ *
+ * Notifies by running the external timeoutd-notify script with the key and
+ * last address as arguments.  For a coalesced group the script gets the
+ * key and address of each entry in turn.
+ *
+ * Scripts are launched and reaped by a single executor thread, which
+ * watches each child through a pidfd in an epoll set instead of sitting in
+ * waitpid().  Up to maxRunning scripts run at once and the rest wait in a
+ * queue, and a script that runs longer than the timeout is killed.  This
+ * way a slow script only holds up its own notification.
+ */
+class ScriptNotifier : public Notifier {
+public:
+	ScriptNotifier(char const *script, int maxRunning, int timeout);
+	virtual ~ScriptNotifier();
+
+	virtual bool start();
+	virtual void stop();
+
+	virtual void notify(EntryRef entry);
+	virtual void notifyGroup(EntryBatch const &group);
+
+	static std::shared_ptr<ScriptNotifier> Create(
+		char const *script, int maxRunning, int timeout)
+	{
+		return std::make_shared<ScriptNotifier>(script, maxRunning, timeout);
+	}
+
+	// Launch a program without waiting for it, with the environment and
+	// attributes we use for notification scripts.  If stdinFd is given it
+	// becomes the program's standard input.  Returns 0 or an errno value
+	// like posix_spawn.
+	static int Spawn(char const *argv[], pid_t *childPid, int stdinFd= -1);
+
+	// The first key of a group and how many others, for log messages
+	static std::string Describe(EntryBatch const &group);
+
+private:
+	struct Child {
+		pid_t pid;
+
+		// -1 if the kernel doesn't support pidfds, in which case we poll
+		int pidfd;
+
+		EntryBatch group;
+
+		// When it was launched, for the notification time histogram
+		int64_t started;
+
+		// Monotonic time after which the child is killed
+		struct timespec deadline;
+		bool killed;
+	};
+
+	std::string script;
+	int maxRunning;
+	int timeout;
+
+	// Script invocations waiting to be launched, protected by mutex
+	std::list<EntryBatch> queue;
+	std::mutex mutex;
+
+	// Everything below is only touched by the executor thread
+	std::list<Child> running;
+
+	int epollFd;
+
+	// Written to wake the executor for new work or to stop
+	int wakeFd;
+
+	volatile bool run;
+	std::thread *thread;
+
+	void loop();
+	void launch(EntryBatch const &group);
+	void reap(std::list<Child>::iterator child, bool block);
+	int nextTimeout();
+};
+
+typedef std::shared_ptr<ScriptNotifier> ScriptNotifierRef;
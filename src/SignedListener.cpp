@@ -1,8 +1,10 @@
 #include "system.h"
 
 #include "Log.h"
-#include "Entry.h"
-#include "Scheduler.h"
+#include "Metrics.h"
+#include "probes.h"
+#include "Receiver.h"
+#include "Payload.h"
 #include "Listener.h"
 #include "UdpListener.h"
 #include "SignedListener.h"
@@ -19,13 +21,13 @@
 #define TIMESTAMP_SLACK 30
 
 SignedListener::SignedListener(
-	SchedulerRef scheduler,
+	ReceiverRef receiver,
 	int family,
 	int port,
 	bool isMulticast) :
 	UdpListener(family, port, isMulticast)
 {
-	this->scheduler= scheduler;
+	this->receiver= receiver;
 }
 
 SignedListener::~SignedListener()
@@ -44,21 +46,27 @@ bool SignedListener::validateHeader(
 
 	time_t timestamp= ntohl(hdr->timestamp);
 	if (ntohs(hdr->magic) != KEEPALIVE_HEADER_MAGIC) {
-		Log::log(LOG_WARNING,
+		LOG_REPEATED(LOG_WARNING, address,
 			"Packet from %s has invalid magic",
 			address);
-	} else if (ntohs(hdr->version) != KEEPALIVE_HEADER_VERSION) {
-		Log::log(LOG_WARNING,
+		Metrics::count(METRIC_PARSE_FAILURES);
+	} else if ((ntohs(hdr->version) != KEEPALIVE_HEADER_VERSION) &&
+		(ntohs(hdr->version) != KEEPALIVE_HEADER_VERSION_MULTI))
+	{
+		LOG_REPEATED(LOG_WARNING, address,
 			"Packet from %s has invalid version",
 			address);
+		Metrics::count(METRIC_PARSE_FAILURES);
 	} else if ((timestamp > now) && ((timestamp - now) > TIMESTAMP_SLACK)) {
-		Log::log(LOG_WARNING,
+		LOG_REPEATED(LOG_WARNING, address,
 			"Packet from %s has Timestamp too far in the future",
 			address);
+		Metrics::count(METRIC_SIGNATURE_FAILURES);
 	} else if ((now > timestamp) && ((now - timestamp) > TIMESTAMP_SLACK)) {
-		Log::log(LOG_WARNING,
+		LOG_REPEATED(LOG_WARNING, address,
 			"Packet from %s has Timestamp too far in the past",
 			address);
+		Metrics::count(METRIC_SIGNATURE_FAILURES);
 	} else {
 		// In >= 1.1 we have to use HMAC_CTX_new and HMAC_CTX_free, but those
 		// don't exist in some older versions I see on Centos 7.
@@ -99,9 +107,10 @@ bool SignedListener::validateHeader(
 		}
 
 		if (!valid) {
-			Log::log(LOG_ERROR,
+			LOG_REPEATED(LOG_ERROR, address,
 				"Packet from %s did not match any known pre-shared key",
 				address);
+			Metrics::count(METRIC_SIGNATURE_FAILURES);
 		}
 
 #if OPENSSL_VERSION_NUMBER >= 0x10100000L
@@ -109,6 +118,8 @@ bool SignedListener::validateHeader(
 #else
 		HMAC_CTX_cleanup(&localCtx);
 #endif
+
+		PROBE2(signature__checked, address, valid);
 	}
 
 	return valid;
@@ -122,43 +133,23 @@ void SignedListener::handlePacket(
 	socklen_t headerSize= sizeof(struct keepalive_hdr);
 
 	if (dataLen < headerSize) {
-		Log::log(LOG_WARNING, "Received packet shorted than header size");
+		LOG_REPEATED(LOG_WARNING, address,
+			"Received packet from %s shorter than header size", address);
+		Metrics::count(METRIC_PARSE_FAILURES);
 	} else if (validateHeader((unsigned char *)data, dataLen, address)) {
-		handlePayload(&data[headerSize], dataLen - headerSize, address);
-	}
-}
-
+		const struct keepalive_hdr *hdr=
+			reinterpret_cast<const struct keepalive_hdr *>(data);
 
-void SignedListener::handlePayload(
-	char const *data,
-	socklen_t dataLen,
-	char const *address)
-{
-	bool validName= true;
-	for (socklen_t i= 0; validName && (i < dataLen); i++) {
-		if (!isalnum(data[i]) && (data[i] != '.') && (data[i] != ':')) {
-			Log::log(LOG_WARNING,
-				"Invalid ASCII in packet at position %d", i);
+		bool multiRecord=
+			(ntohs(hdr->version) == KEEPALIVE_HEADER_VERSION_MULTI);
 
-			validName= false;
-		}
-	}
-
-	if (validName) {
-		std::string key(data, dataLen);
-		int timeout= 30;
-
-		size_t offset= key.find(':');
-		if (offset != std::string::npos) {
-			std::string timeoutString= key.substr(offset + 1);
-			key= key.substr(0, offset);
-			timeout= atoi(timeoutString.c_str());
-		}
-
-		scheduler->receive(key.c_str(), timeout, address);
+		bool parsed= Payload::Parse(&data[headerSize],
+			dataLen - headerSize, address, receiver.get(), multiRecord);
+		PROBE2(packet__parsed, address, parsed);
 	}
 }
 
+
 PreSharedKey::PreSharedKey(char const *value)
 {
 	memset(key, 0, KEEPALIVE_HMAC_SIZE);
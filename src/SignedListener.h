@@ -29,14 +29,14 @@ typedef std::shared_ptr<PreSharedKey> PreSharedKeyRef;
  */
 class SignedListener : public UdpListener {
 public:
-	SignedListener(SchedulerRef, int family, int port, bool isMulticast);
+	SignedListener(ReceiverRef, int family, int port, bool isMulticast);
 	virtual ~SignedListener();
 
 	static std::shared_ptr<SignedListener> Create(
-		SchedulerRef scheduler, int family, int port, bool isMulticast)
+		ReceiverRef receiver, int family, int port, bool isMulticast)
 	{
 		return std::make_shared<SignedListener>(
-			scheduler, family, port, isMulticast);
+			receiver, family, port, isMulticast);
 	}
 
 	void addPreSharedKey(char const *key) {
@@ -48,16 +48,13 @@ protected:
 	bool validateHeader(
 		unsigned char *data, socklen_t dataLen, char const *address);
 
-	// Handle the payload after the header.
-	void handlePayload(
-		char const *data, socklen_t dataLen, char const *address);
 
 	// Handle the packet from the socket
 	virtual void handlePacket(
 		char const *data, socklen_t dataLen, char const *address);
 
 private:
-	SchedulerRef scheduler;
+	ReceiverRef receiver;
 
 	std::list<PreSharedKeyRef> keyList;
 };
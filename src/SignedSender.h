@@ -14,7 +14,7 @@ public:
 		socklen_t addrLen,
 		int frequency,
 		char const *preSharedKey,
-		char const *key,
+		std::list<std::string> const &keys,
 		int timeout);
 
 	virtual ~SignedSender();
@@ -22,12 +22,11 @@ public:
 	static std::shared_ptr<Sender> Create(
 		char const *address, int port, int frequency,
 		char const *preSharedKey,
-		char const *key, int timeout);
+		std::list<std::string> const &keys, int timeout);
 
 private:
-	std::string key;
-	int timeout;
-
-	unsigned char hmacKey[32];
+	// All the keys are packed into as few packets as possible, so usually
+	// this is just one.
+	std::list<KeepalivePacket> packets;
 };
 
@@ -1,22 +1,21 @@
 #include "system.h"
 
 #include "Log.h"
-#include "Entry.h"
-#include "Scheduler.h"
+#include "probes.h"
+#include "Receiver.h"
+#include "Payload.h"
 #include "Listener.h"
 #include "UdpListener.h"
 #include "SimpleListener.h"
 
-#define RECV_BUFFER_SIZE 2047
-
 SimpleListener::SimpleListener(
-	SchedulerRef scheduler,
+	ReceiverRef receiver,
 	int family,
 	int port,
 	bool isMulticast) :
 	UdpListener(family, port, isMulticast)
 {
-	this->scheduler= scheduler;
+	this->receiver= receiver;
 }
 
 SimpleListener::~SimpleListener()
@@ -28,28 +27,6 @@ void SimpleListener::handlePacket(
 	socklen_t dataLen,
 	char const *address)
 {
-	bool validName= true;
-	for (socklen_t i= 0; validName && (i < dataLen); i++) {
-		if (!isalnum(data[i]) && (data[i] != '.') && (data[i] != ':')) {
-			Log::log(LOG_WARNING,
-				"Invalid ASCII in packet at position %d", i);
-
-			validName= false;
-		}
-	}
-
-	if (validName) {
-		std::string key(data, dataLen);
-		int timeout= 30;
-
-		size_t offset= key.find(':');
-		if (offset != std::string::npos) {
-			std::string timeoutString= key.substr(offset + 1);
-			key= key.substr(0, offset);
-			timeout= atoi(timeoutString.c_str());
-		}
-
-		scheduler->receive(key.c_str(), timeout, address);
-	}
+	bool parsed= Payload::Parse(data, dataLen, address, receiver.get(), true);
+	PROBE2(packet__parsed, address, parsed);
 }
-
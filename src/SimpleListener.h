@@ -5,18 +5,19 @@ typedef std::shared_ptr<Scheduler> SchedulerRef;
  * SimpleListener
  *
  * A listener that decodes the simple protocol, which is just a UDP packet
- * containing the key, with an optional colon and timeout at the end.
+ * containing the key, with an optional colon and timeout at the end.  A
+ * packet can carry several of these separated by newlines.
  */
 class SimpleListener : public UdpListener {
 public:
-	SimpleListener(SchedulerRef, int family, int port, bool isMulticast);
+	SimpleListener(ReceiverRef, int family, int port, bool isMulticast);
 	virtual ~SimpleListener();
 
 	static std::shared_ptr<Listener> Create(
-		SchedulerRef scheduler, int family, int port, bool isMulticast)
+		ReceiverRef receiver, int family, int port, bool isMulticast)
 	{
 		return std::make_shared<SimpleListener>(
-			scheduler, family, port, isMulticast);
+			receiver, family, port, isMulticast);
 	}
 
 protected:
@@ -24,7 +25,7 @@ protected:
 		char const *data, socklen_t dataLen, char const *address);
 
 private:
-	SchedulerRef scheduler;
+	ReceiverRef receiver;
 };
 
 typedef std::shared_ptr<Listener> ListenerRef;
@@ -3,25 +3,36 @@
 #include "Log.h"
 #include "Sender.h"
 #include "UdpSender.h"
+#include "KeepalivePacket.h"
 #include "SimpleSender.h"
 
 SimpleSender::SimpleSender(
 	struct sockaddr *addr,
 	socklen_t addrLen,
 	int frequency,
-	char const *key,
+	std::list<std::string> const &keys,
 	int timeout) :
 	UdpSender(addr, addrLen, frequency)
 {
-	this->key= key;
-	this->timeout= timeout;
+	for (std::string const &key : keys) {
+		if (packets.empty() ||
+			!packets.back().addRecord(key.c_str(), timeout))
+		{
+			packets.emplace_back();
+			if (!packets.back().addRecord(key.c_str(), timeout)) {
+				Log::log(LOG_ERROR,
+					"Sender key %s is too long", key.c_str());
+				packets.pop_back();
+			}
+		}
+	}
 }
 
 SenderRef SimpleSender::Create(
 	char const *host,
 	int port,
 	int frequency,
-	char const *key,
+	std::list<std::string> const &keys,
 	int timeout)
 {
 	SenderRef rval;
@@ -32,10 +43,18 @@ SenderRef SimpleSender::Create(
 
 	socklen_t addressLen= sizeof(addressBuffer);
 
-	if (ParseAddress(host, port, address, addressLen)) {
+	bool validKeys= true;
+	for (std::string const &key : keys) {
+		if (!KeepalivePacket::ValidKey(key.c_str())) {
+			Log::log(LOG_ERROR, "Invalid sender key %s", key.c_str());
+			validKeys= false;
+		}
+	}
+
+	if (validKeys && ParseAddress(host, port, address, addressLen)) {
 		rval= std::make_shared<SimpleSender>(
 			address, addressLen, frequency,
-			key, timeout);
+			keys, timeout);
 	}
 
 	return rval;
@@ -43,20 +62,18 @@ SenderRef SimpleSender::Create(
 
 void SimpleSender::sendPacket(int sock)
 {
-	std::string data= key;
-	data.append(":");
-	data.append(std::to_string(timeout));
-
-	int sentLen= send(sock, data.c_str(), data.length(), 0);
+	for (KeepalivePacket &packet : packets) {
+		int sentLen= packet.send(sock, 0);
 
-	if (sentLen == -1) {
-		// If the destination isn't listening on the port we get a
-		// ECONNREFUSED because of the ICMP port unreachable message.
-		// This is a normal thing when the other end isn't up yet.
-		if (errno != ECONNREFUSED) {
-			Log::log(LOG_ERROR,
-				"Error sending UDP packet: %s",
-				strerror(errno));
+		if (sentLen == -1) {
+			// If the destination isn't listening on the port we get a
+			// ECONNREFUSED because of the ICMP port unreachable message.
+			// This is a normal thing when the other end isn't up yet.
+			if (errno != ECONNREFUSED) {
+				Log::log(LOG_ERROR,
+					"Error sending UDP packet: %s",
+					strerror(errno));
+			}
 		}
 	}
 }
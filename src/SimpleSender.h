@@ -12,17 +12,18 @@ public:
 		struct sockaddr *addr,
 		socklen_t addrLen,
 		int frequency,
-		char const *key,
+		std::list<std::string> const &keys,
 		int timeout);
 
 	virtual ~SimpleSender();
 
 	static std::shared_ptr<Sender> Create(
 		char const *address, int port, int frequency,
-		char const *key, int timeout);
+		std::list<std::string> const &keys, int timeout);
 
 private:
-	std::string key;
-	int timeout;
+	// All the keys are packed into as few packets as possible, so usually
+	// this is just one.
+	std::list<KeepalivePacket> packets;
 };
 
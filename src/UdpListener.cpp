@@ -1,8 +1,12 @@
 #include "system.h"
 
 #include "Log.h"
+#include "Metrics.h"
+#include "probes.h"
 #include "Entry.h"
+#include "Receiver.h"
 #include "Scheduler.h"
+#include "RateLimiter.h"
 #include "Listener.h"
 #include "UdpListener.h"
 
@@ -30,7 +34,7 @@ UdpListener::~UdpListener()
 
 void UdpListener::listenLoop()
 {
-	int sock= socket(family, SOCK_DGRAM, IPPROTO_UDP);
+	int sock= socket(family, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_UDP);
 	if (sock == -1) {
 		Log::log(LOG_ERROR,
 			"Unable to create an %s UDP socket: %s",
@@ -90,6 +94,17 @@ void UdpListener::listenLoop()
 			Log::log(LOG_DEBUG,
 				"Listening on %s UDP port %d", familyName, port);
 
+			// The kernel's receive timestamp lets the ingest latency
+			// include time spent waiting in the socket buffer.
+			int one= 1;
+			if (setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS,
+				&one, sizeof(one)) == -1)
+			{
+				Log::log(LOG_DEBUG,
+					"No receive timestamps on %s UDP port %d: %s",
+					familyName, port, strerror(errno));
+			}
+
 			bool localRun= run;
 			while (localRun) {
 				fd_set readFds;
@@ -108,22 +123,44 @@ void UdpListener::listenLoop()
 				} else if (selectRval > 0) {
 					if (FD_ISSET(sock, &readFds)) {
 						char data[RECV_BUFFER_SIZE];
+						char control[CMSG_SPACE(sizeof(struct timespec))];
 
-						addrLen= sizeof(addrBuffer);
-						int dataLen= recvfrom(sock, data,
-							RECV_BUFFER_SIZE, MSG_DONTWAIT,
-							addr, &addrLen);
+						struct iovec iov;
+						iov.iov_base= data;
+						iov.iov_len= RECV_BUFFER_SIZE;
+
+						struct msghdr message;
+						memset(&message, 0, sizeof(message));
+						message.msg_name= addr;
+						message.msg_namelen= sizeof(addrBuffer);
+						message.msg_iov= &iov;
+						message.msg_iovlen= 1;
+						message.msg_control= control;
+						message.msg_controllen= sizeof(control);
+
+						int dataLen= recvmsg(sock, &message, MSG_DONTWAIT);
 
 						if (dataLen < 0) {
-							Log::log(LOG_WARNING,
+							LOG(LOG_WARNING,
 								"Error reading data packet: %s",
 								strerror(errno));
 						} else if (dataLen > 0) {
-							char addrString[INET6_ADDRSTRLEN];
-							inet_ntop(family,
-								addrPart, addrString, INET_ADDRSTRLEN);
-
-							handlePacket(data, dataLen, addrString);
+							Metrics::count(METRIC_PACKETS_RECEIVED);
+
+							// Over the limit is dropped without a word,
+							// since the limiter counts it.
+							if (!rateLimiter ||
+								rateLimiter->allow(family, addrPart))
+							{
+								char addrString[INET6_ADDRSTRLEN];
+								inet_ntop(family,
+									addrPart, addrString, INET_ADDRSTRLEN);
+
+								PROBE2(packet__received, addrString, dataLen);
+
+								handlePacket(data, dataLen, addrString);
+								recordIngest(&message);
+							}
 						}
 					}
 				}
@@ -137,9 +174,31 @@ void UdpListener::listenLoop()
 	}
 }
 
+void UdpListener::recordIngest(struct msghdr *message)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	for (struct cmsghdr *cmsg= CMSG_FIRSTHDR(message);
+		cmsg != NULL; cmsg= CMSG_NXTHDR(message, cmsg))
+	{
+		if ((cmsg->cmsg_level == SOL_SOCKET) &&
+			(cmsg->cmsg_type == SCM_TIMESTAMPNS))
+		{
+			struct timespec received;
+			memcpy(&received, CMSG_DATA(cmsg), sizeof(received));
+
+			Metrics::record(HIST_INGEST,
+				(int64_t)(now.tv_sec - received.tv_sec) * 1000000000LL +
+				(now.tv_nsec - received.tv_nsec));
+			return;
+		}
+	}
+}
+
 bool UdpListener::start()
 {
-	if (pipe(stopPipe) == -1) {
+	if (pipe2(stopPipe, O_CLOEXEC) == -1) {
 		Log::log(LOG_ERROR,
 			"Unable to create UDP stop pipe pair: %s",
 			strerror(errno));
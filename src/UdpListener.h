@@ -1,3 +1,6 @@
+class RateLimiter;
+typedef std::shared_ptr<RateLimiter> RateLimiterRef;
+
 #define MCAST_ADDRESS "239.42.173.94"
 
 /**
@@ -25,8 +28,13 @@ private:
 
 	char const *familyName;
 
+	RateLimiterRef rateLimiter;
+
 	void listenLoop();
 
+	// Time from the kernel receiving the packet until it was handled
+	void recordIngest(struct msghdr *message);
+
 protected:
 	// This is the protocol-level packet handler defined in the child class
 	virtual void handlePacket(
@@ -38,6 +46,11 @@ public:
 
 	virtual bool start();
 	virtual void stop();
+
+	// Packets from sources over the limit are dropped before parsing
+	void setRateLimiter(RateLimiterRef rateLimiter) {
+		this->rateLimiter= rateLimiter;
+	}
 };
 
 
@@ -116,7 +116,7 @@ bool UdpSender::ParseAddress(
 
 void UdpSender::sendLoop()
 {
-	int sock= socket(family, SOCK_DGRAM, IPPROTO_UDP);
+	int sock= socket(family, SOCK_DGRAM | SOCK_CLOEXEC, IPPROTO_UDP);
 	if (sock == -1) {
 		Log::log(LOG_ERROR,
 			"Unable to create an outgoing UDP socket: %s",
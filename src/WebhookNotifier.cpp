@@ -0,0 +1,328 @@
+#include "system.h"
+
+#include "Log.h"
+#include "Metrics.h"
+#include "Entry.h"
+#include "Notifier.h"
+#include "HttpConnection.h"
+#include "WebhookNotifier.h"
+
+// Most entries we'll hold waiting for a sender
+#define MAX_QUEUED 100000
+
+// Most entries sent in one request
+#define MAX_REQUEST_BATCH 256
+
+// Attempts per request before giving up, and the delay before the first
+// retry in seconds, which doubles each time after.
+#define MAX_ATTEMPTS 5
+#define RETRY_DELAY 1
+
+WebhookNotifier::WebhookNotifier(bool useTls, char const *host, int port,
+	char const *path, int senderCount, int timeout)
+{
+	this->useTls= useTls;
+	this->host= host;
+	this->port= port;
+	this->path= path;
+	this->senderCount= senderCount;
+	this->timeout= timeout;
+
+	sslCtx= NULL;
+	run= false;
+
+	struct utsname nameInfo;
+	if (uname(&nameInfo) == 0) {
+		source= nameInfo.nodename;
+	}
+}
+
+WebhookNotifier::~WebhookNotifier()
+{
+}
+
+std::shared_ptr<WebhookNotifier> WebhookNotifier::Create(
+	char const *url, int senderCount, int timeout)
+{
+	std::shared_ptr<WebhookNotifier> rval;
+
+	bool useTls;
+	int port;
+	char const *rest;
+
+	if (strncmp(url, "http://", 7) == 0) {
+		useTls= false;
+		port= 80;
+		rest= url + 7;
+	} else if (strncmp(url, "https://", 8) == 0) {
+		useTls= true;
+		port= 443;
+		rest= url + 8;
+	} else {
+		Log::log(LOG_ERROR, "Webhook URL must be http or https: %s", url);
+		return rval;
+	}
+
+	char const *slash= strchr(rest, '/');
+	std::string hostPort= (slash == NULL) ?
+		std::string(rest) : std::string(rest, slash - rest);
+	std::string path= (slash == NULL) ? "/" : slash;
+
+	// IPv6 literals are in brackets, so the port is after the bracket
+	std::string host;
+	size_t portStart= std::string::npos;
+	if (!hostPort.empty() && (hostPort[0] == '[')) {
+		size_t close= hostPort.find(']');
+		if (close != std::string::npos) {
+			host= hostPort.substr(1, close - 1);
+			if ((close + 1 < hostPort.size()) && (hostPort[close + 1] == ':')) {
+				portStart= close + 2;
+			} else if (close + 1 < hostPort.size()) {
+				host.clear();
+			}
+		}
+	} else {
+		size_t colon= hostPort.find(':');
+		host= hostPort.substr(0, colon);
+		if (colon != std::string::npos) {
+			portStart= colon + 1;
+		}
+	}
+
+	if (portStart != std::string::npos) {
+		char *end;
+		port= strtol(hostPort.c_str() + portStart, &end, 10);
+		if ((*end != '\0') || (port < 1) || (port > 65535)) {
+			port= -1;
+		}
+	}
+
+	if (host.empty() || (port == -1)) {
+		Log::log(LOG_ERROR, "Unable to parse webhook URL %s", url);
+		return rval;
+	}
+
+	rval= std::make_shared<WebhookNotifier>(useTls,
+		host.c_str(), port, path.c_str(), senderCount, timeout);
+
+	return rval;
+}
+
+bool WebhookNotifier::start()
+{
+	if (useTls) {
+#if OPENSSL_VERSION_NUMBER >= 0x10100000L
+		sslCtx= SSL_CTX_new(TLS_client_method());
+#else
+		sslCtx= SSL_CTX_new(SSLv23_client_method());
+#endif
+		if (sslCtx == NULL) {
+			Log::log(LOG_ERROR, "Unable to create TLS context");
+			return false;
+		}
+
+		SSL_CTX_set_options(sslCtx, SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3);
+		SSL_CTX_set_verify(sslCtx, SSL_VERIFY_PEER, NULL);
+		if (!SSL_CTX_set_default_verify_paths(sslCtx)) {
+			Log::log(LOG_WARNING, "Unable to load default CA certificates");
+		}
+	}
+
+	run= true;
+	for (int i= 0; i < senderCount; i++) {
+		threads.push_back(new std::thread(&WebhookNotifier::loop, this));
+	}
+
+	Log::log(LOG_DEBUG, "Sending notifications to %s://%s:%d%s",
+		useTls ? "https" : "http", host.c_str(), port, path.c_str());
+
+	return true;
+}
+
+void WebhookNotifier::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		run= false;
+	}
+	wake.notify_all();
+	stopWake.notify_all();
+
+	while (!threads.empty()) {
+		std::thread *thread= threads.front();
+		threads.pop_front();
+
+		thread->join();
+		delete thread;
+	}
+
+	if (!queue.empty()) {
+		Log::log(LOG_WARNING,
+			"Discarding %d queued notifications at shutdown",
+			(int)queue.size());
+		queue.clear();
+	}
+
+	if (sslCtx != NULL) {
+		SSL_CTX_free(sslCtx);
+		sslCtx= NULL;
+	}
+}
+
+void WebhookNotifier::notify(EntryRef entry)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if (queue.size() >= MAX_QUEUED) {
+			Log::log(LOG_ERROR,
+				"Notification queue is full - dropping notification for %s",
+				entry->getKey());
+			return;
+		}
+		queue.push_back(entry);
+	}
+	wake.notify_one();
+}
+
+void WebhookNotifier::notifyBatch(EntryBatch const &batch)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for (EntryRef entry : batch) {
+			if (queue.size() >= MAX_QUEUED) {
+				Log::log(LOG_ERROR,
+					"Notification queue is full - dropping notification for %s",
+					entry->getKey());
+			} else {
+				queue.push_back(entry);
+			}
+		}
+	}
+	wake.notify_one();
+}
+
+// Keys and addresses are always plain, but the node name might not be
+static void appendJsonString(std::string& out, char const *text)
+{
+	out.push_back('"');
+	for (char const *c= text; *c != '\0'; c++) {
+		if ((*c == '"') || (*c == '\\')) {
+			out.push_back('\\');
+			out.push_back(*c);
+		} else if ((unsigned char)*c < 0x20) {
+			char escape[8];
+			snprintf(escape, sizeof(escape), "\\u%04x", (unsigned char)*c);
+			out.append(escape);
+		} else {
+			out.push_back(*c);
+		}
+	}
+	out.push_back('"');
+}
+
+void WebhookNotifier::makeBody(EntryBatch const &batch, std::string& body)
+{
+	body= "{\"source\":";
+	appendJsonString(body, source.c_str());
+	body.append(",\"timestamp\":");
+	body.append(std::to_string((long)time(NULL)));
+	body.append(",\"timeouts\":[");
+
+	bool first= true;
+	for (EntryRef entry : batch) {
+		body.append(first ? "{\"key\":" : ",{\"key\":");
+		appendJsonString(body, entry->getKey());
+		body.append(",\"address\":");
+		appendJsonString(body, entry->getLastAddress());
+		body.append("}");
+		first= false;
+	}
+
+	body.append("]}");
+}
+
+void WebhookNotifier::loop()
+{
+	HttpConnection connection(host.c_str(), port, sslCtx, timeout);
+	EntryBatch batch;
+	std::string body;
+
+	for (;;) {
+		batch.clear();
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			while (run && queue.empty()) {
+				wake.wait(lock);
+			}
+			if (!run) {
+				break;
+			}
+
+			while (!queue.empty() && (batch.size() < MAX_REQUEST_BATCH)) {
+				batch.push_back(queue.front());
+				queue.pop_front();
+			}
+
+			// Let another sender pick up the rest
+			if (!queue.empty()) {
+				wake.notify_one();
+			}
+		}
+
+		makeBody(batch, body);
+
+		// Timed over all the attempts, since that's how long the
+		// notification took to get there
+		int64_t started= Metrics::now();
+
+		for (int attempt= 1; ; attempt++) {
+			int status= 0;
+			bool sent= connection.post(
+				path.c_str(), "application/json", body, &status);
+
+			if (sent && (status >= 200) && (status < 300)) {
+				Metrics::record(HIST_NOTIFY, Metrics::now() - started);
+				Log::log(LOG_DEBUG, "Webhook accepted %d notifications",
+					(int)batch.size());
+				break;
+			}
+
+			bool retry= !sent || (status >= 500) ||
+				(status == 408) || (status == 429);
+
+			if (!retry) {
+				Log::log(LOG_ERROR,
+					"Webhook rejected %d notifications with status %d",
+					(int)batch.size(), status);
+				break;
+			}
+			if (attempt >= MAX_ATTEMPTS) {
+				Log::log(LOG_ERROR,
+					"Giving up on %d notifications after %d attempts",
+					(int)batch.size(), attempt);
+				break;
+			}
+
+			int delay= RETRY_DELAY << (attempt - 1);
+			if (sent) {
+				Log::log(LOG_WARNING,
+					"Webhook returned status %d, retrying in %d seconds",
+					status, delay);
+			} else {
+				Log::log(LOG_WARNING,
+					"Webhook request failed, retrying in %d seconds", delay);
+			}
+
+			std::unique_lock<std::mutex> lock(mutex);
+			stopWake.wait_for(lock, std::chrono::seconds(delay),
+				[this]{ return !run; });
+
+			if (!run) {
+				Log::log(LOG_WARNING,
+					"Discarding %d notifications at shutdown",
+					(int)batch.size());
+				break;
+			}
+		}
+	}
+}
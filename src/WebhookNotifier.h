@@ -0,0 +1,66 @@
+class HttpConnection;
+
+/**
+ * WebhookNotifier
+ *
+ * Notifies by POSTing expired entries to an HTTP or HTTPS webhook, without
+ * any process creation.
+ *
+ * A fixed pool of sender threads each keeps its own keep-alive connection
+ * to the server.  A sender takes whatever has queued up, up to a limit, and
+ * sends it as one JSON body:
+ *
+ *     {"source":"node","timestamp":1700000000,"timeouts":[
+ *         {"key":"node.web1","address":"192.0.2.1"}, ...]}
+ *
+ * So at most one request per sender is in flight.  A request that fails
+ * with a connection problem, a server error, 408 or 429 is retried with
+ * exponential backoff, and any other response is treated as final.
+ */
+class WebhookNotifier : public Notifier {
+public:
+	WebhookNotifier(bool useTls, char const *host, int port,
+		char const *path, int senderCount, int timeout);
+	virtual ~WebhookNotifier();
+
+	virtual bool start();
+	virtual void stop();
+
+	virtual void notify(EntryRef entry);
+	virtual void notifyBatch(EntryBatch const &batch);
+
+	// Parse a URL of the form http[s]://host[:port][/path].  Returns an
+	// empty reference if it can't be parsed.
+	static std::shared_ptr<WebhookNotifier> Create(
+		char const *url, int senderCount, int timeout);
+
+private:
+	bool useTls;
+	std::string host;
+	int port;
+	std::string path;
+	int senderCount;
+	int timeout;
+
+	std::string source;
+
+	SSL_CTX *sslCtx;
+
+	// Entries waiting for a sender, protected by mutex
+	std::list<EntryRef> queue;
+	std::mutex mutex;
+
+	// Signals work for the senders
+	std::condition_variable wake;
+
+	// Signals senders waiting to retry that we're stopping
+	std::condition_variable stopWake;
+
+	volatile bool run;
+	std::list<std::thread *> threads;
+
+	void loop();
+	void makeBody(EntryBatch const &batch, std::string& body);
+};
+
+typedef std::shared_ptr<WebhookNotifier> WebhookNotifierRef;
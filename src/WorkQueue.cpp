@@ -0,0 +1,75 @@
+#include "system.h"
+
+#include "Metrics.h"
+#include "Entry.h"
+#include "WorkQueue.h"
+
+WorkQueue::WorkQueue(size_t limit)
+{
+	this->limit= limit;
+	run= true;
+}
+
+WorkQueue::~WorkQueue()
+{
+}
+
+size_t WorkQueue::push(EntryBatch const &batch)
+{
+	size_t dropped= 0;
+	Queued queued;
+	queued.queuedAt= Metrics::now();
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		size_t room= batch.size();
+		if ((limit != 0) && (queue.size() + batch.size() > limit)) {
+			room= (queue.size() < limit) ? (limit - queue.size()) : 0;
+			dropped= batch.size() - room;
+		}
+
+		for (size_t i= 0; i < room; i++) {
+			queued.entry= batch[i];
+			queue.push_back(queued);
+		}
+	}
+
+	if (batch.size() > 1) {
+		wake.notify_all();
+	} else {
+		wake.notify_one();
+	}
+
+	return dropped;
+}
+
+bool WorkQueue::take(EntryBatch& batch, size_t maxBatch)
+{
+	std::unique_lock<std::mutex> lock(mutex);
+
+	while (run && queue.empty()) {
+		wake.wait(lock);
+	}
+	if (!run) {
+		return false;
+	}
+
+	int64_t now= Metrics::now();
+	while (!queue.empty() && (batch.size() < maxBatch)) {
+		Metrics::record(HIST_QUEUE_WAIT, now - queue.front().queuedAt);
+
+		batch.push_back(queue.front().entry);
+		queue.pop_front();
+	}
+
+	return true;
+}
+
+void WorkQueue::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		run= false;
+		queue.clear();
+	}
+	wake.notify_all();
+}
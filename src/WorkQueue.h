@@ -0,0 +1,60 @@
+class Entry;
+typedef std::shared_ptr<Entry> EntryRef;
+
+typedef std::vector<EntryRef> EntryBatch;
+
+/**
+ * WorkQueue
+ *
+ * Expired entries waiting for a notification worker.  This has its own
+ * lock, separate from the scheduler's, so workers taking work never
+ * contend with keepalives coming in.  The scheduler adds everything that
+ * expired in one pass with a single push, and workers take up to a batch
+ * at a time, so even in an expiry storm the lock is held briefly and
+ * rarely.
+ *
+ * The queue can have a limit, past which new entries are dropped.
+ */
+class WorkQueue {
+public:
+	WorkQueue(size_t limit);
+	virtual ~WorkQueue();
+
+	// Returns how many entries were dropped because the queue was full
+	size_t push(EntryBatch const &batch);
+
+	// Wait for at least one entry and then take up to maxBatch.  Returns
+	// false once the queue is stopped, and anything still queued is
+	// dropped.
+	bool take(EntryBatch& batch, size_t maxBatch);
+
+	// Wake everything waiting in take() and make it return false
+	void stop();
+
+	size_t size() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return queue.size();
+	}
+
+	// A limit of zero means no limit
+	static std::shared_ptr<WorkQueue> Create(size_t limit) {
+		return std::make_shared<WorkQueue>(limit);
+	}
+
+private:
+	// Each entry with when it was queued, for the queue wait histogram
+	struct Queued {
+		EntryRef entry;
+		int64_t queuedAt;
+	};
+
+	std::list<Queued> queue;
+	size_t limit;
+
+	std::mutex mutex;
+	std::condition_variable wake;
+
+	bool run;
+};
+
+typedef std::shared_ptr<WorkQueue> WorkQueueRef;
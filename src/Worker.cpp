@@ -1,14 +1,18 @@
 #include "system.h"
 
 #include "Log.h"
+#include "Metrics.h"
+#include "probes.h"
 
 #include "Entry.h"
-#include "Scheduler.h"
+#include "Notifier.h"
+#include "WorkQueue.h"
 #include "Worker.h"
 
-Worker::Worker(Scheduler *scheduler)
+Worker::Worker(WorkQueueRef queue, NotifierRef notifier)
 {
-	this->scheduler= scheduler;
+	this->queue= queue;
+	this->notifier= notifier;
 }
 
 Worker::~Worker()
@@ -17,17 +21,10 @@ Worker::~Worker()
 
 void Worker::start()
 {
-	run= true;
 	thread= new std::thread(&Worker::loop, this);
 }
 
-void Worker::stop1()
-{
-	std::lock_guard<std::mutex> lock(mutex);
-	run= false;
-}
-
-void Worker::stop2()
+void Worker::stop()
 {
 	thread->join();
 	delete thread;
@@ -35,17 +32,23 @@ void Worker::stop2()
 
 void Worker::loop()
 {
-	bool localRun= run;
-
-	while (localRun) {
-		EntryRef entry= scheduler->getWork();
+	EntryBatch batch;
 
-		if (entry) {
-			entry->notify();
+	while (queue->take(batch, MAX_WORK_BATCH)) {
+		for (EntryRef entry : batch) {
+			LOG(LOG_INFO,
+				"Timeout for %s (%s)",
+				entry->getKey(), entry->getLastAddress());
 		}
 
-		std::lock_guard<std::mutex> lock(mutex);
-		localRun= run;
+		int64_t started= Metrics::now();
+		PROBE2(notify__start, batch.front()->getKey(), batch.size());
+
+		notifier->notifyBatch(batch);
+		Metrics::count(METRIC_NOTIFICATIONS, batch.size());
+
+		PROBE3(notify__done, batch.front()->getKey(), batch.size(),
+			Metrics::now() - started);
+		batch.clear();
 	}
 }
-
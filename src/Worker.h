@@ -1,36 +1,30 @@
-class Scheduler;
+class WorkQueue;
+typedef std::shared_ptr<WorkQueue> WorkQueueRef;
+
+class Notifier;
+typedef std::shared_ptr<Notifier> NotifierRef;
 
 /**
  * Worker
  *
- * A notification worker.  The scheduler maintains a fixed set of these for
- * doing the actual notifications.
+ * A notification worker.  The scheduler maintains a fixed set of these that
+ * take expired entries off the work queue and hand them to the notifier.
  */
 class Worker {
 public:
-	Worker(Scheduler *);
+	Worker(WorkQueueRef, NotifierRef);
 	virtual ~Worker();
 
 	void start();
 
-	// stop1 flags the worker to stop, and stop2 joins and collects the thread
-	//
-	// This is necessary because the workers block in Scheduler::getWork, so
-	// the worker itself has no clean way to kick that loose.  Since the
-	// scheduler is controlling the stop anyway, it was easier to let it
-	// control everything.
-
-	void stop1();
-	void stop2();
+	// The worker blocks in WorkQueue::take, so the queue has to be stopped
+	// first to kick it loose.  This then joins the thread.
+	void stop();
 
 private:
-	// Raw pointer instead of std::shared_ptr so we don't create a reference
-	// loop that prevents auto-disposal.  The workers are owned by the
-	// schedulers and destroyed first.
-	Scheduler *scheduler;
+	WorkQueueRef queue;
 
-	std::mutex mutex;
-	volatile bool run;
+	NotifierRef notifier;
 
 	std::thread *thread;
 
@@ -1,17 +1,35 @@
 #include "system.h"
 
 #include "Entry.h"
+#include "Receiver.h"
 #include "Scheduler.h"
 
+#include "Notifier.h"
+#include "ScriptNotifier.h"
+#include "HelperNotifier.h"
+#include "plugin.h"
+#include "PluginNotifier.h"
+#include "HttpConnection.h"
+#include "WebhookNotifier.h"
+#include "CoalescingNotifier.h"
+#include "Route.h"
+#include "Router.h"
+#include "EventServer.h"
+#include "RateLimiter.h"
+#include "Metrics.h"
+#include "MetricsServer.h"
+
 #include "Listener.h"
 #include "UdpListener.h"
 #include "SimpleListener.h"
 #include "SignedListener.h"
 
+#include "KeepalivePacket.h"
 #include "Sender.h"
 #include "UdpSender.h"
 #include "SimpleSender.h"
 #include "SignedSender.h"
+#include "Relay.h"
 
 #include "Multicast.h"
 
@@ -32,7 +50,7 @@ static void doExit(int junk)
 static void addSender(
 	std::list<std::string>& preSharedKeys,
 	int senderFrequency,
-	char const *senderKey,
+	std::list<std::string> const &senderKeys,
 	int senderTimeout,
 	std::list<SenderRef>& senders,
 	char const *peer)
@@ -40,7 +58,7 @@ static void addSender(
 	if (preSharedKeys.empty()) {
 		SenderRef sender= SimpleSender::Create(peer,
 			KEEPALIVE_SIMPLE_PORT, senderFrequency,
-			senderKey, senderTimeout);
+			senderKeys, senderTimeout);
 
 		if (!sender) {
 			Log::log(LOG_ERROR, "Unable to parse sender %s", peer);
@@ -53,7 +71,7 @@ static void addSender(
 		SenderRef sender= SignedSender::Create(peer,
 			KEEPALIVE_SIGNED_PORT, senderFrequency,
 			firstKey.c_str(),
-			senderKey, senderTimeout);
+			senderKeys, senderTimeout);
 
 		if (!sender) {
 			Log::log(LOG_ERROR, "Unable to parse sender %s", peer);
@@ -66,7 +84,7 @@ static void addSender(
 static void addSenderFile(
 	std::list<std::string>& preSharedKeys,
 	int senderFrequency,
-	char const *senderKey,
+	std::list<std::string> const &senderKeys,
 	int senderTimeout,
 	std::list<SenderRef>& senders,
 	char const *path)
@@ -98,7 +116,7 @@ static void addSenderFile(
 
 		if (line[0] != '\0') {
 			addSender(
-				preSharedKeys, senderFrequency, senderKey,
+				preSharedKeys, senderFrequency, senderKeys,
 				senderTimeout, senders, line);
 		}
 	}
@@ -111,9 +129,12 @@ int main(int argc, char* argv[])
 	signal(SIGTERM, doExit);
 	signal(SIGINT, doExit);
 
+	Log::start();
+
 	opensslStartupIncantations();
 
 	int entryLimit= 200;
+	int verbosity= 0;
 
 	std::list<SenderRef> senders;
 
@@ -123,7 +144,30 @@ int main(int argc, char* argv[])
 	bool useMulticast= false;
 	int multicastTtl= 5;
 
-	std::string senderKey;
+	char const *relayHost= NULL;
+	int relayFrequency= 1;
+
+	bool lazyRescheduling= true;
+	int workerCount= 4;
+	char const *routeFile= NULL;
+	char const *eventSocket= NULL;
+	char const *rateLimit= NULL;
+	char const *metricsAddress= NULL;
+
+	char const *notifyScript= SCRIPTDIR "/timeoutd-notify";
+	int maxScripts= 4;
+	int scriptTimeout= 60;
+	char const *notifyHelper= NULL;
+	char const *notifyPlugin= NULL;
+	char const *notifyWebhook= NULL;
+
+	int coalesceWindow= 0;
+	CoalescingNotifier::GroupBy coalesceGroupBy= CoalescingNotifier::GROUP_ALL;
+	int coalesceMinimum= 3;
+
+	// The first -K replaces the default key, and any more are added to it
+	std::list<std::string> senderKeys;
+	bool senderKeysGiven= false;
 	{
 		struct utsname nameInfo;
 		if (uname(&nameInfo) == -1) {
@@ -138,8 +182,9 @@ int main(int argc, char* argv[])
 			*firstDot= '\0';
 		}
 
-		senderKey= "node.";
+		std::string senderKey= "node.";
 		senderKey.append(nameInfo.nodename);
+		senderKeys.push_back(senderKey);
 	}
 
 	std::list<std::string> preSharedKeys;
@@ -150,7 +195,9 @@ int main(int argc, char* argv[])
 	}
 
 	int c;
-	while ((c= getopt(argc, argv, "F:T:K:p:P:s:M:mvl:")) != -1) {
+	while ((c= getopt(argc, argv,
+		"F:T:K:p:P:s:M:mvl:R:I:Ec:t:H:L:W:C:g:n:w:r:S:q:X:")) != -1)
+	{
 		switch (c) {
 		case 'F':
 			senderFrequency= atoi(optarg);
@@ -169,7 +216,11 @@ int main(int argc, char* argv[])
 			break;
 
 		case 'K':
-			senderKey= optarg;
+			if (!senderKeysGiven) {
+				senderKeys.clear();
+				senderKeysGiven= true;
+			}
+			senderKeys.push_back(optarg);
 			break;
 
 		case 'M':
@@ -194,22 +245,115 @@ int main(int argc, char* argv[])
 
 		case 'p':
 			addSender(
-				preSharedKeys, senderFrequency, senderKey.c_str(),
+				preSharedKeys, senderFrequency, senderKeys,
 				senderTimeout, senders, optarg);
 			break;
 
 		case 'P':
 			addSenderFile(
-				preSharedKeys, senderFrequency, senderKey.c_str(),
+				preSharedKeys, senderFrequency, senderKeys,
 				senderTimeout, senders, optarg);
 			break;
 
 		case 's':
-			Entry::setNotifyScript(optarg);
+			notifyScript= optarg;
+			break;
+
+		case 'H':
+			notifyHelper= optarg;
+			break;
+
+		case 'L':
+			notifyPlugin= optarg;
+			break;
+
+		case 'W':
+			notifyWebhook= optarg;
+			break;
+
+		case 'C':
+			coalesceWindow= atoi(optarg);
+			if (coalesceWindow < 0) {
+				Log::log(LOG_ERROR, "Invalid coalescing window");
+				exit(1);
+			}
+			break;
+
+		case 'g':
+			if (!CoalescingNotifier::ParseGroupBy(optarg, &coalesceGroupBy)) {
+				Log::log(LOG_ERROR, "Coalescing group must be prefix or subnet");
+				exit(1);
+			}
+			break;
+
+		case 'n':
+			coalesceMinimum= atoi(optarg);
+			if (coalesceMinimum < 1) {
+				Log::log(LOG_ERROR, "Invalid coalescing minimum");
+				exit(1);
+			}
+			break;
+
+		case 'w':
+			workerCount= atoi(optarg);
+			if (workerCount < 1) {
+				Log::log(LOG_ERROR, "Invalid worker count");
+				exit(1);
+			}
+			break;
+
+		case 'r':
+			routeFile= optarg;
+			break;
+
+		case 'S':
+			eventSocket= optarg;
+			break;
+
+		case 'q':
+			rateLimit= optarg;
+			break;
+
+		case 'X':
+			metricsAddress= optarg;
+			break;
+
+		case 'c':
+			maxScripts= atoi(optarg);
+			if (maxScripts < 1) {
+				Log::log(LOG_ERROR, "Invalid value for script concurrency");
+				exit(1);
+			}
+			break;
+
+		case 't':
+			scriptTimeout= atoi(optarg);
+			if (scriptTimeout < 0) {
+				Log::log(LOG_ERROR, "Invalid value for script timeout");
+				exit(1);
+			}
 			break;
 
 		case 'v':
-			Log::setLogLevel(LOG_DEBUG);
+			// A second -v adds tracing of every keepalive and expiry
+			verbosity++;
+			Log::setLogLevel((verbosity > 1) ? LOG_TRACE : LOG_DEBUG);
+			break;
+
+		case 'R':
+			relayHost= optarg;
+			break;
+
+		case 'E':
+			lazyRescheduling= false;
+			break;
+
+		case 'I':
+			relayFrequency= atoi(optarg);
+			if (relayFrequency <= 0) {
+				Log::log(LOG_ERROR, "Invalid relay frequency");
+				exit(1);
+			}
 			break;
 	
 		default:
@@ -225,28 +369,143 @@ int main(int argc, char* argv[])
 		}
 	}
 
+	// One limiter is shared by all the listeners, so a source gets the
+	// same allowance whichever port and protocol it uses.
+	RateLimiterRef rateLimiter;
+	if (rateLimit != NULL) {
+		rateLimiter= RateLimiter::Create(rateLimit);
+		if (!rateLimiter) {
+			exit(1);
+		}
+	}
+
+	MetricsServerRef metricsServer;
+	if (metricsAddress != NULL) {
+		metricsServer= MetricsServer::Create(metricsAddress);
+		if (!metricsServer) {
+			exit(1);
+		}
+	}
+
+	NotifierRef notifier;
+	if (notifyWebhook != NULL) {
+		notifier= WebhookNotifier::Create(
+			notifyWebhook, maxScripts, scriptTimeout);
+		if (!notifier) {
+			exit(1);
+		}
+	} else if (notifyPlugin != NULL) {
+		notifier= PluginNotifier::Create(notifyPlugin);
+	} else if (notifyHelper != NULL) {
+		notifier= HelperNotifier::Create(notifyHelper);
+	} else {
+		notifier= ScriptNotifier::Create(
+			notifyScript, maxScripts, scriptTimeout);
+	}
+
+	if (coalesceWindow > 0) {
+		notifier= CoalescingNotifier::Create(notifier,
+			coalesceWindow, coalesceGroupBy, coalesceMinimum);
+	}
+
+	// Keys that don't match anything in the route file use the notifier
+	// from the command line.
+	RouterRef router=
+		Router::Create(Route::Create("", notifier, workerCount, 0));
+
+	if (routeFile != NULL) {
+		RouteSettings routeSettings;
+		routeSettings.workers= workerCount;
+		routeSettings.queueLimit= 0;
+		routeSettings.concurrency= maxScripts;
+		routeSettings.timeout= scriptTimeout;
+		routeSettings.coalesceWindow= coalesceWindow;
+		routeSettings.coalesceGroupBy= coalesceGroupBy;
+		routeSettings.coalesceMinimum= coalesceMinimum;
+
+		if (!router->load(routeFile, routeSettings)) {
+			exit(1);
+		}
+	}
+
+	if (!router->start()) {
+		Log::log(LOG_ERROR, "Unable to start notifier");
+		exit(1);
+	}
+
+	EventServerRef events;
+	if (eventSocket != NULL) {
+		events= EventServer::Create(eventSocket);
+		if (!events->start()) {
+			exit(1);
+		}
+	}
+
 	SchedulerRef scheduler= Scheduler::Create(entryLimit);
+	scheduler->setLazyRescheduling(lazyRescheduling);
+	scheduler->setRouter(router);
+	scheduler->setEventServer(events);
 	scheduler->start();
 
+	if (metricsServer) {
+		metricsServer->addGauge("timeoutd_entries",
+			"Keys and leases being monitored",
+			[scheduler]{ return scheduler->getEntryCount(); });
+		metricsServer->addGauge("timeoutd_notification_queue_depth",
+			"Timeouts waiting for a notification worker",
+			[router]{ return router->getQueued(); });
+
+		if (!metricsServer->start()) {
+			exit(1);
+		}
+	}
+
+	// In relay mode whatever the listeners receive goes upstream instead
+	// of being monitored here.
+	ReceiverRef receiver= scheduler;
+
+	if (relayHost != NULL) {
+		RelayRef relay;
+
+		if (preSharedKeys.empty()) {
+			relay= Relay::Create(relayHost,
+				KEEPALIVE_SIMPLE_PORT, relayFrequency, NULL, entryLimit);
+		} else {
+			std::string firstKey= preSharedKeys.front();
+
+			relay= Relay::Create(relayHost,
+				KEEPALIVE_SIGNED_PORT, relayFrequency,
+				firstKey.c_str(), entryLimit);
+		}
+
+		if (!relay) {
+			Log::log(LOG_ERROR, "Unable to parse relay %s", relayHost);
+			exit(1);
+		}
+
+		senders.push_back(relay);
+		receiver= relay;
+	}
+
 	std::list<ListenerRef> listeners;
 
 	listeners.push_back(SimpleListener::Create(
-		scheduler, AF_INET, KEEPALIVE_SIMPLE_PORT, useMulticast));
+		receiver, AF_INET, KEEPALIVE_SIMPLE_PORT, useMulticast));
 	listeners.push_back(SimpleListener::Create(
-		scheduler, AF_INET6, KEEPALIVE_SIMPLE_PORT, false));
+		receiver, AF_INET6, KEEPALIVE_SIMPLE_PORT, false));
 
 	if (!preSharedKeys.empty()) {
 		SignedListenerRef listener;
 
 		listener= SignedListener::Create(
-			scheduler, AF_INET, KEEPALIVE_SIGNED_PORT, useMulticast);
+			receiver, AF_INET, KEEPALIVE_SIGNED_PORT, useMulticast);
 		for (std::string key : preSharedKeys) {
 			listener->addPreSharedKey(key.c_str());
 		}
 		listeners.push_back(listener);
 
 		listener= SignedListener::Create(
-			scheduler, AF_INET6, KEEPALIVE_SIGNED_PORT, false);
+			receiver, AF_INET6, KEEPALIVE_SIGNED_PORT, false);
 		for (std::string key : preSharedKeys) {
 			listener->addPreSharedKey(key.c_str());
 		}
@@ -254,6 +513,10 @@ int main(int argc, char* argv[])
 	}
 
 	for (ListenerRef listener : listeners) {
+		if (rateLimiter) {
+			std::static_pointer_cast<UdpListener>(listener)->
+				setRateLimiter(rateLimiter);
+		}
 		listener->start();
 	}
 
@@ -261,7 +524,7 @@ int main(int argc, char* argv[])
 		if (preSharedKeys.empty()) {
 			SenderRef sender= SimpleSender::Create(MCAST_ADDRESS,
 				KEEPALIVE_SIMPLE_PORT, senderFrequency,
-				senderKey.c_str(), senderTimeout);
+				senderKeys, senderTimeout);
 
 			senders.push_back(sender);
 		} else {
@@ -270,7 +533,7 @@ int main(int argc, char* argv[])
 			SenderRef sender= SignedSender::Create(MCAST_ADDRESS,
 				KEEPALIVE_SIGNED_PORT, senderFrequency,
 				firstKey.c_str(),
-				senderKey.c_str(), senderTimeout);
+				senderKeys, senderTimeout);
 
 			senders.push_back(sender);
 		}
@@ -297,9 +560,22 @@ int main(int argc, char* argv[])
 	}
 	listeners.clear();
 
+	if (metricsServer) {
+		Log::log(LOG_DEBUG, "Stopping Metrics Server");
+		metricsServer->stop();
+	}
+
 	Log::log(LOG_DEBUG, "Stopping Scheduler");
 	scheduler->stop();
 
+	Log::log(LOG_DEBUG, "Stopping Notifiers");
+	router->stop();
+
+	if (events) {
+		Log::log(LOG_DEBUG, "Stopping Event Server");
+		events->stop();
+	}
+
 	Log::log(LOG_INFO, "Normal shutdown");
 
 	opensslShutdownIncantations();
@@ -0,0 +1,57 @@
+/*
+ * This file defines the interface for in-process notification plugins,
+ * loaded with the -L flag.  A plugin is a shared object that exports the
+ * three functions below with C linkage.
+ *
+ * It is installed along with the client library, so unlike the rest of the
+ * headers it has to stand on its own, and it's plain C so plugins can be
+ * written in anything that can produce a C ABI.
+ */
+
+#ifndef TIMEOUTD_PLUGIN_H
+#define TIMEOUTD_PLUGIN_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Bumped when anything below changes incompatibly
+#define TIMEOUTD_PLUGIN_ABI_VERSION 1
+
+struct timeoutd_expiry {
+	// The key that timed out, and the address it was last received from
+	char const *key;
+	char const *address;
+};
+
+// Called once at startup, before any notifications.  The argument is
+// whatever followed the comma in -L path,argument or NULL if there wasn't
+// one.  A plugin can store anything it likes in *state, which is passed
+// back to the other calls.  Return 0 on success, or anything else to make
+// the daemon refuse to start.
+int timeoutd_plugin_init(int abi_version, char const *argument, void **state);
+
+// Called with a batch of keys that expired around the same time.  The
+// array and strings are only valid for the duration of the call.
+//
+// This is called directly from the daemon's notification workers, so it
+// should return promptly and leave anything slow to its own threads.
+// Calls are never concurrent with each other.
+void timeoutd_plugin_notify(void *state,
+	struct timeoutd_expiry const *expiries, size_t count);
+
+// Called once at shutdown, after the last notification.
+void timeoutd_plugin_shutdown(void *state);
+
+typedef int (*timeoutd_plugin_init_t)(int, char const *, void **);
+typedef void (*timeoutd_plugin_notify_t)(void *,
+	struct timeoutd_expiry const *, size_t);
+typedef void (*timeoutd_plugin_shutdown_t)(void *);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
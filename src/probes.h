@@ -0,0 +1,45 @@
+// USDT probes for attaching bpftrace, perf or SystemTap to a running
+// daemon.  With <sys/sdt.h> each probe is a single nop plus a note in the
+// ELF file describing where its arguments are, so a probe nobody is
+// attached to costs nothing.  Without the header they compile away.
+//
+// The probes, all in the "timeoutd" provider:
+//
+//   packet__received   address, length
+//   packet__parsed     address, ok
+//   signature__checked address, ok
+//   key__create        key, address, timeout
+//   key__defer         key, address, timeout
+//   key__remove        key, address
+//   key__reject        key, address
+//   key__expire        key, address, lateness in ns
+//   notify__start      first key, entries
+//   notify__done       first key, entries, duration in ns
+//   script__done       first key, pid, status, duration in ns
+//
+// When a lease is removed or expires, key__remove or key__expire fires for
+// each key attached to it as well as for the lease's own "@name" key.
+
+#ifdef HAVE_SYS_SDT_H
+
+#include <sys/sdt.h>
+
+#define PROBE2(name, a, b) \
+	DTRACE_PROBE2(timeoutd, name, a, b)
+#define PROBE3(name, a, b, c) \
+	DTRACE_PROBE3(timeoutd, name, a, b, c)
+#define PROBE4(name, a, b, c, d) \
+	DTRACE_PROBE4(timeoutd, name, a, b, c, d)
+
+#else
+
+// The arguments are still mentioned so nothing computed only for a probe
+// is reported unused.  Keep them free of side effects.
+#define PROBE2(name, a, b) \
+	do { (void)(a); (void)(b); } while (0)
+#define PROBE3(name, a, b, c) \
+	do { (void)(a); (void)(b); (void)(c); } while (0)
+#define PROBE4(name, a, b, c, d) \
+	do { (void)(a); (void)(b); (void)(c); (void)(d); } while (0)
+
+#endif
@@ -1,20 +1,33 @@
 /*
  * This file defines the wire format for the secured version of the UDP
  * protocol.
+ *
+ * It is installed along with the client library, so unlike the rest of the
+ * headers it has to stand on its own.
  */
 
+#ifndef TIMEOUTD_PROTOCOL_H
+#define TIMEOUTD_PROTOCOL_H
+
 #define KEEPALIVE_SIMPLE_PORT (2952)
 #define KEEPALIVE_SIGNED_PORT (2953)
 
 // Magic number
 #define KEEPALIVE_HEADER_MAGIC 0xb049
 
-// Version number
+// Version number.  Version 1 carries a single record after the header.
+// Version 2 carries one or more records separated by newlines, all covered
+// by the one HMAC.
 #define KEEPALIVE_HEADER_VERSION 0x0001
+#define KEEPALIVE_HEADER_VERSION_MULTI 0x0002
 
 // Size of HMAC - this corresponds to SHA-256
 #define KEEPALIVE_HMAC_SIZE 32
 
+// Largest datagram a sender should build.  Listeners will take more than
+// this, but staying under a typical MTU avoids fragmentation.
+#define KEEPALIVE_MAX_PACKET 1400
+
 // Don't let the compiler insert shims (that is, align to 1 byte)
 #pragma pack(push, 1)
 
@@ -34,3 +47,4 @@ struct keepalive_hdr {
 
 #pragma pack(pop)
 
+#endif
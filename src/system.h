@@ -1,15 +1,28 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <memory>
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <functional>
+#include <chrono>
 #include <condition_variable>
 #include <mutex>
 #include <thread>
 #include <list>
+#include <queue>
+#include <vector>
 #include <map>
 #include <set>
 
 #include <unistd.h>
 #include <signal.h>
+#include <spawn.h>
+#include <dlfcn.h>
 #include <sys/utsname.h>
 #include <sys/types.h>
 #include <sys/wait.h>
@@ -17,14 +30,21 @@
 #include <sys/time.h>
 #include <time.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <sys/uio.h>
 #include <math.h>
 #include <string.h>
 
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+
 #include <sys/ioctl.h>
 #include <linux/if.h>
 #include <linux/sockios.h>